@@ -1,13 +1,29 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets.
+// Each bucket's lock protects its chain and the refcnt and used
+// fields of the buffers on it, so lookups of different blocks
+// proceed in parallel. bcache.lock serializes recycling: a buffer
+// changes its (dev, blockno), and so its bucket, only while
+// bcache.lock is held, which keeps a block from being cached twice.
+// Unused buffers are recycled in CLOCK order.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * To have many writes in flight at once, call bwrite_start on
+//     each buffer, or bstartv on all of them, and then bwait on
+//     each before releasing it.
+// * To start reading blocks that will be needed soon, call
+//     bprefetch; it does not wait for the disk.
+// * bstartv and bprefetch send buffers for consecutive blocks
+//     to the disk as one request, of up to MAXSEG blocks.
+// * To copy a block only if it is already cached, call bpeek.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -23,33 +39,125 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 1021
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;   // chain through buf.next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes recycling of buffers
+  int nbuf;              // number of buffers, set by binit()
+  struct bucket bucket[NBUCKET];
+  struct buf *hand;      // CLOCK hand, on the ring through buf.cnext
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(blockno ^ (dev << 16)) % NBUCKET];
+}
+
+// Allocate the buffers, giving their data 1/BUFMEM of the
+// free memory but making at least NBUF of them. The buf
+// structures and their data come from kalloc()ed pages.
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *b, *prev;
+  struct bucket *bk;
+  uchar *data;
+  int i, nbuf;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head = 0;
+  }
+
+  nbuf = kfreepages() / BUFMEM * (PGSIZE / BSIZE);
+  if(nbuf < NBUF)
+    nbuf = NBUF;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Spread the buffers over the buckets by pretending that
+  // buffer i holds block i of the (nonexistent) device 0.
+  b = prev = 0;
+  data = 0;
+  for(i = 0; i < nbuf; i++){
+    if(i % (PGSIZE / sizeof(struct buf)) == 0){
+      if((b = (struct buf*)kalloc()) == 0)
+        panic("binit");
+      memset(b, 0, PGSIZE);
+    }
+    if(i % (PGSIZE / BSIZE) == 0 && (data = kalloc()) == 0)
+      panic("binit");
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->data = data + (i % (PGSIZE / BSIZE)) * BSIZE;
+    b->dev = 0;
+    b->blockno = i;
+    bk = bhash(b->dev, b->blockno);
+    b->next = bk->head;
+    bk->head = b;
+    if(prev)
+      prev->cnext = b;
+    else
+      bcache.hand = b;
+    prev = b;
+    b++;
+  }
+  prev->cnext = bcache.hand;
+  bcache.nbuf = nbuf;
+}
+
+// Look for block on device dev in bucket bk, which must be locked.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b != 0; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Choose an unused buffer to recycle, using the CLOCK
+// algorithm: sweep bcache.hand around the ring, skipping
+// buffers in use and giving recently released ones a second
+// chance. Returns the buffer, removed from its bucket.
+// Caller must hold bcache.lock.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b, **pp;
+  struct bucket *bk;
+  int i;
+
+  // after one full sweep every unused buffer has had its
+  // used bit cleared, so two sweeps must find one if any exists.
+  for(i = 0; i < 2*bcache.nbuf; i++){
+    b = bcache.hand;
+    bcache.hand = b->cnext;
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    // a buffer with a prefetch in flight has refcnt 0,
+    // but the disk still owns it.
+    if(b->refcnt == 0 && b->disk == 0){
+      if(b->used){
+        b->used = 0;
+      } else {
+        for(pp = &bk->head; *pp != b; pp = &(*pp)->next)
+          ;
+        *pp = b->next;
+        release(&bk->lock);
+        return b;
+      }
+    }
+    release(&bk->lock);
   }
+  panic("bget: no buffers");
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,33 +167,48 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached. Another CPU may have cached the block since
+  // we looked, so look again now that we hold bcache.lock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+
+  // Recycle an unused buffer. No other CPU can insert
+  // this block while we hold bcache.lock.
+  b = bvictim();
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  acquire(&bk->lock);
+  b->next = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,10 +221,65 @@ bread(uint dev, uint blockno)
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
+  } else if(b->disk) {
+    // bprefetch() started reading it.
+    virtio_disk_wait(b);
   }
   return b;
 }
 
+// Start reading blocks blockno..blockno+n-1 into the cache,
+// except those already there, and return without waiting for
+// the disk. A later bread() of a block waits for its read to
+// finish.
+void
+bprefetch(uint dev, uint blockno, int n)
+{
+  struct buf *bs[MAXSEG], *rd[MAXSEG];
+  int i, m, nrd;
+
+  for(; n > 0; n -= m, blockno += m){
+    m = n < MAXSEG ? n : MAXSEG;
+    nrd = 0;
+    for(i = 0; i < m; i++){
+      bs[i] = bget(dev, blockno + i);
+      if(!bs[i]->valid) {
+        rd[nrd++] = bs[i];
+        bs[i]->valid = 1;
+      }
+    }
+    bstartv(rd, nrd, 0);
+    for(i = 0; i < m; i++)
+      brelse(bs[i]);
+  }
+}
+
+// If the indicated block is cached, copy it to dst and return 1;
+// otherwise return 0, leaving the cache alone. The page cache
+// uses this to read file data without caching it here, while
+// still seeing blocks that are newer here than on disk.
+int
+bpeek(uint dev, uint blockno, uchar *dst)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) == 0 || !b->valid){
+    release(&bk->lock);
+    return 0;
+  }
+  b->refcnt++;
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  if(b->disk)
+    virtio_disk_wait(b);  // bprefetch() started reading it.
+  memmove(dst, b->data, BSIZE);
+  brelse(b);
+  return 1;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +289,82 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing b's contents to disk, without waiting for
+// the write to finish. Must be locked, and the caller must
+// call bwait(b) before changing b->data or releasing b.
+void
+bwrite_start(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_start");
+  virtio_disk_submit(b, 1);
+}
+
+// Start reading, or writing if write is set, the n buffers
+// bs[0..n-1], merging each run of buffers for consecutive
+// blocks into one disk request. Return without waiting; the
+// caller must own the buffers and must wait for each, as
+// bwait() does, before using or releasing it.
+void
+bstartv(struct buf **bs, int n, int write)
+{
+  int i, j;
+
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && j - i < MAXSEG; j++){
+      if(bs[j]->dev != bs[i]->dev || bs[j]->blockno != bs[i]->blockno + (j - i))
+        break;
+    }
+    virtio_disk_submitv(bs + i, j - i, write);
+  }
+}
+
+// Wait for a write started by bwrite_start() or bstartv() to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Mark it recently used, for the CLOCK hand in bvictim().
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->used = 1;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
-
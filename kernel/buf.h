@@ -5,8 +5,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  int used;    // released since the CLOCK hand last passed?
+  struct buf *next;  // hash bucket chain
+  struct buf *cnext; // ring of all buffers, for the CLOCK hand
+  struct buf *dnext; // next buf in the same disk request
+  uchar *data;       // BSIZE bytes
 };
 
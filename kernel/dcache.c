@@ -0,0 +1,157 @@
+// Directory name cache.
+//
+// The dcache remembers the results of dirlookup(): for a
+// directory and a name, the inode number the name refers to
+// and the offset of its entry, or that the name isn't there.
+// namex() looks up every element of a path with dirlookup(),
+// so the dcache saves reading and searching each directory
+// on the way again.
+//
+// An entry is keyed by (dev, directory inum, name), and all
+// use of a directory's entries is under the directory's inode
+// lock, as are the changes to the directory they describe:
+// dirlink() and unlink() update the entry for the name they
+// change, and itrunc() of a directory drops its entries before
+// its inode number can be reused. dcache.lock protects the hash
+// chains and the used bits. Entries are recycled in CLOCK order.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDBUCKET 127
+
+struct dentry {
+  uint dev;
+  uint dir;             // directory's inode number; 0 if free
+  char name[DIRSIZ];
+  uint inum;            // 0 if name isn't in dir
+  uint off;             // byte offset of the name's dirent
+  int used;             // looked up since the CLOCK hand last passed?
+  struct dentry *next;  // hash bucket chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry *bucket[NDBUCKET];
+  struct dentry entry[NDCACHE];
+  int hand;             // CLOCK hand, an index into entry[]
+} dcache;
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+dhash(uint dev, uint dir, char *name)
+{
+  uint h = dir ^ (dev << 24);
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.bucket[h % NDBUCKET];
+}
+
+// Look for the entry for name in dp.
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dp->dev, dp->inum, name); d; d = d->next)
+    if(d->dev == dp->dev && d->dir == dp->inum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Take d off its hash chain and mark it free.
+// Caller must hold dcache.lock.
+static void
+dfree(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dhash(d->dev, d->dir, d->name); *pp != d; pp = &(*pp)->next)
+    ;
+  *pp = d->next;
+  d->dir = 0;
+}
+
+// If the dcache knows about name in dp, set *inum to the inode
+// number it names, or 0 if it isn't there, and *off to the offset
+// of its entry, and return 1. Otherwise return 0.
+// Caller must hold dp->lock.
+int
+dcachelookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  d->used = 1;
+  *inum = d->inum;
+  *off = d->off;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in dp names inode inum, with its entry at
+// offset off, or, if inum is 0, that dp has no such name.
+// Caller must hold dp->lock.
+void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **bk;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) == 0){
+    // recycle an entry not looked up lately.
+    for(;;){
+      d = &dcache.entry[dcache.hand];
+      dcache.hand = (dcache.hand + 1) % NDCACHE;
+      if(d->dir == 0)
+        break;
+      if(!d->used){
+        dfree(d);
+        break;
+      }
+      d->used = 0;
+    }
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    bk = dhash(d->dev, d->dir, d->name);
+    d->next = *bk;
+    *bk = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  d->used = 1;
+  release(&dcache.lock);
+}
+
+// Forget everything about directory dp, which is being freed.
+// Caller must hold dp->lock.
+void
+dcachepurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < &dcache.entry[NDCACHE]; d++)
+    if(d->dir == dp->inum && d->dev == dp->dev)
+      dfree(d);
+  release(&dcache.lock);
+}
@@ -2,18 +2,26 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct page;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vdso;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_start(struct buf*);
+void            bstartv(struct buf**, int, int);
+void            bwait(struct buf*);
+void            bprefetch(uint, uint, int);
+int             bpeek(uint, uint, uchar*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -22,6 +30,12 @@ void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(struct inode*, char*, uint*, uint*);
+void            dcacheenter(struct inode*, char*, uint, uint);
+void            dcachepurge(struct inode*);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -33,9 +47,11 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filevmsplice(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
+uint            bmap(struct inode*, uint, int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -63,18 +79,34 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+int             kfreepages(void);
+void            kref(void *);
+int             krefcnt(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxop(void);
+
+// pcache.c
+void            pinit(void);
+struct page*    pget(struct inode*, uint);
+void            prelse(struct page*);
+int             pcached(struct inode*, uint);
+void            pupdate(struct inode*, uint, uchar*, uint);
+void            pinval(struct inode*);
+char*           pmap(struct inode*, uint);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipevmsplice(struct pipe*, uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -101,6 +133,7 @@ void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+void            schedtick(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -139,11 +172,16 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            timerwheelinit(void);
+void            timertick(void);
+int             timersleep(int);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
+extern struct vdso *vdso;
 void            usertrapret(void);
 
 // uart.c
@@ -166,6 +204,17 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmfault(struct proc *, uint64, int);
+void            uvmprefault(uint64, uint64, int);
+uint64          uvmcowpage(struct proc *, uint64);
+int             uvmremap(struct proc *, uint64, uint64);
+void            vmacount(struct vma *, int);
+void            vmadup(struct vma *);
+void            vmaput(struct vma *);
+int             vmawriteback(pagetable_t, struct vma *, uint64, uint64);
+int             vmasync(pagetable_t, struct vma *);
+uint64          vmamap(struct inode *, uint64, int, int, uint);
+int             vmaunmap(uint64, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -180,6 +229,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_submitv(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -77,6 +77,11 @@ fileclose(struct file *f)
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
     begin_op();
+    if(ff.type == FD_INODE && ff.writable){
+      ilock(ff.ip);
+      ff.ip->nwrite--;
+      iunlock(ff.ip);
+    }
     iput(ff.ip);
     end_op();
   }
@@ -111,6 +116,10 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // the copy to addr happens under the pipe, console
+  // or inode lock.
+  uvmprefault(addr, n, 1);
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -139,6 +148,8 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  uvmprefault(addr, n, 0);
+
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -148,23 +159,28 @@ filewrite(struct file *f, uint64 addr, int n)
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, indirect and double-indirect blocks,
+    // allocation blocks, and 2 blocks of slop for
+    // non-aligned writes.
+    // each chunk reserves just the log space it needs.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = ((log_maxop()-1-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
+      int nop = 2 * ((n1 + BSIZE - 1) / BSIZE) + 1 + 1 + 1 + 2;
+      if(nop < MAXOPBLOCKS)
+        nop = MAXOPBLOCKS;
 
-      begin_op();
+      begin_opn(nop);
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
-      end_op();
+      end_opn(nop);
 
       if(r != n1){
         // error from writei
@@ -180,3 +196,16 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Move n bytes between the pipe f and user address addr,
+// remapping whole pages rather than copying them where it can:
+// into the pipe if f is its write end, out of it if the read end.
+int
+filevmsplice(struct file *f, uint64 addr, int n)
+{
+  if(f->type != FD_PIPE)
+    return -1;
+
+  uvmprefault(addr, n, f->readable);
+  return pipevmsplice(f->pipe, addr, n, f->writable);
+}
@@ -18,15 +18,23 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // hash bucket chain
+  struct inode *lnext; // LRU list of unreferenced inodes; 0 if not on it
+  struct inode *lprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ranext;        // readahead: block after the last one read
+  uint rawin;         // readahead: window size, in blocks
+  uint raend;         // readahead: blocks below this were prefetched
+  int nwrite;         // writable opens and shared writable mappings
+  int ntext;          // exec()ed segments mapping it
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // map major device number to device functions.
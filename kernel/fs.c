@@ -20,8 +20,13 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "page.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+
+// readahead window limits, in blocks.
+#define RAMIN 4
+#define RAMAX 16
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -37,6 +42,8 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void freeinit(int dev);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +51,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  freeinit(dev);
 }
 
 // Zero a block.
@@ -59,22 +67,81 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// freemap summarizes the free bitmap: how many blocks each
+// bitmap block marks free, so that balloc() reads only bitmap
+// blocks with a free block in them, and where the last
+// allocation was, so that files without blocks yet are placed
+// one after another (next fit). A file's other blocks go as
+// close after its previous block as possible, which keeps
+// sequential reads of it sequential on the disk.
+// The counts change only with their bitmap block locked,
+// and freemap.lock protects them; freeinit() computes them
+// at boot, after the log has been recovered.
+
+struct {
+  struct spinlock lock;
+  int nbmap;      // number of bitmap blocks
+  int *nfree;     // free blocks marked in each bitmap block
+  uint cursor;    // block after the last one allocated
+} freemap;
+
+static void
+freeinit(int dev)
+{
+  struct buf *bp;
+  int i, bi;
+
+  initlock(&freemap.lock, "freemap");
+  freemap.nbmap = (sb.size + BPB - 1) / BPB;
+  if(freemap.nbmap > PGSIZE / sizeof(int))
+    panic("freeinit: too many bitmap blocks");
+  if((freemap.nfree = (int*)kalloc()) == 0)
+    panic("freeinit");
+  for(i = 0; i < freemap.nbmap; i++){
+    bp = bread(dev, BBLOCK(i * BPB, sb));
+    freemap.nfree[i] = 0;
+    for(bi = 0; bi < BPB && i * BPB + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        freemap.nfree[i]++;
+    brelse(bp);
+  }
+  freemap.cursor = 0;
+}
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, the first free one after
+// block near, or after the last one allocated if near is 0.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint near)
 {
-  int b, bi, m;
+  int b, bi, m, i, nfree;
+  uint goal;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  acquire(&freemap.lock);
+  goal = near ? near + 1 : freemap.cursor;
+  release(&freemap.lock);
+  if(goal >= sb.size)
+    goal = 0;
+  // start in goal's bitmap block, at goal; come back to
+  // the part of it before goal last.
+  for(i = 0; i <= freemap.nbmap; i++){
+    b = (goal / BPB + i) % freemap.nbmap * BPB;
+    acquire(&freemap.lock);
+    nfree = freemap.nfree[b / BPB];
+    release(&freemap.lock);
+    if(nfree == 0)
+      continue;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    for(bi = i == 0 ? goal % BPB : 0; bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
+        acquire(&freemap.lock);
+        freemap.nfree[b / BPB]--;
+        freemap.cursor = b + bi + 1;
+        release(&freemap.lock);
         brelse(bp);
         bzero(dev, b + bi);
         return b + bi;
@@ -99,6 +166,9 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  acquire(&freemap.lock);
+  freemap.nfree[b / BPB]++;
+  release(&freemap.lock);
   brelse(bp);
 }
 
@@ -127,18 +197,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref. An entry
+//   whose ref is zero stays in the table, so that a later
+//   iget() of the same inode finds it still valid, until
+//   iget() recycles it for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -162,28 +233,94 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is hashed by (dev, inum) into NIBUCKET buckets.
+// Each bucket's lock protects its chain and the ref of the
+// inodes on it, so iget() and iput() of different inodes
+// proceed in parallel. itable.lock serializes recycling: an
+// entry changes its ip->dev and ip->inum, and so its bucket,
+// only while itable.lock is held, which keeps an inode from
+// being in the table twice. Entries whose ref is zero are on
+// the itable.lru list, least recently released first, and
+// iget() recycles from its front; itable.lrulock protects the
+// list. An entry taken by iget() stays on the list until
+// ivictim() finds it in use and drops it, or iput() moves it
+// to the back.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, and the links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
-struct {
+#define NIBUCKET 127
+
+struct ibucket {
   struct spinlock lock;
+  struct inode *head;   // chain through inode.next
+};
+
+struct {
+  struct spinlock lock;     // serializes recycling of entries
+  struct ibucket bucket[NIBUCKET];
+  struct spinlock lrulock;
+  struct inode lru;         // head of the list through inode.lnext
   struct inode inode[NINODE];
 } itable;
 
+static struct ibucket*
+ihash(uint dev, uint inum)
+{
+  return &itable.bucket[(inum ^ (dev << 16)) % NIBUCKET];
+}
+
+// Remove ip from the LRU list.
+// Caller must hold itable.lrulock.
+static void
+lrudel(struct inode *ip)
+{
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+  ip->lnext = ip->lprev = 0;
+}
+
+// Put ip at the back of the LRU list, or at the
+// front if first is set.
+// Caller must hold itable.lrulock.
+static void
+lruadd(struct inode *ip, int first)
+{
+  struct inode *prev = first ? &itable.lru : itable.lru.lprev;
+
+  ip->lnext = prev->lnext;
+  ip->lprev = prev;
+  prev->lnext->lprev = ip;
+  prev->lnext = ip;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  struct inode *ip;
+  struct ibucket *bk;
+  int i;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  initlock(&itable.lrulock, "itable.lru");
+  for(bk = itable.bucket; bk < itable.bucket+NIBUCKET; bk++){
+    initlock(&bk->lock, "itable.bucket");
+    bk->head = 0;
+  }
+  itable.lru.lnext = itable.lru.lprev = &itable.lru;
+
+  // Spread the free entries over the buckets by pretending
+  // that entry i holds inode i of the (nonexistent) device 0.
+  for(i = 0; i < NINODE; i++){
+    ip = &itable.inode[i];
+    initsleeplock(&ip->lock, "inode");
+    ip->dev = 0;
+    ip->inum = i;
+    bk = ihash(ip->dev, ip->inum);
+    ip->next = bk->head;
+    bk->head = ip;
+    lruadd(ip, 0);
   }
 }
 
@@ -236,37 +373,96 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Look for inode inum on device dev in bucket bk,
+// which must be locked.
+static struct inode*
+ifind(struct ibucket *bk, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = bk->head; ip != 0; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  }
+  return 0;
+}
+
+// Choose the least recently released unreferenced entry to
+// recycle. Returns the entry, removed from its bucket.
+// Caller must hold itable.lock.
+static struct inode*
+ivictim(void)
+{
+  struct inode *ip, **pp;
+  struct ibucket *bk;
+
+  for(;;){
+    acquire(&itable.lrulock);
+    ip = itable.lru.lnext;
+    if(ip == &itable.lru)
+      panic("iget: no inodes");
+    lrudel(ip);
+    release(&itable.lrulock);
+
+    // iget() may have taken ip since it was released, and
+    // iput() may even have put it back on the list; holding
+    // ip's bucket lock keeps both from happening now.
+    bk = ihash(ip->dev, ip->inum);
+    acquire(&bk->lock);
+    if(ip->ref == 0 && ip->lnext == 0){
+      for(pp = &bk->head; *pp != ip; pp = &(*pp)->next)
+        ;
+      *pp = ip->next;
+      release(&bk->lock);
+      return ip;
+    }
+    release(&bk->lock);
+  }
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct ibucket *bk;
 
-  acquire(&itable.lock);
+  bk = ihash(dev, inum);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  acquire(&bk->lock);
+  if((ip = ifind(bk, dev, inum)) != 0){
+    ip->ref++;
+    release(&bk->lock);
+    return ip;
   }
+  release(&bk->lock);
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Not in the table. Another CPU may have added it since
+  // we looked, so look again now that we hold itable.lock.
+  acquire(&itable.lock);
+  acquire(&bk->lock);
+  if((ip = ifind(bk, dev, inum)) != 0){
+    ip->ref++;
+    release(&bk->lock);
+    release(&itable.lock);
+    return ip;
+  }
+  release(&bk->lock);
 
-  ip = empty;
+  // Recycle an inode entry. No other CPU can add
+  // this inode while we hold itable.lock.
+  ip = ivictim();
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  acquire(&bk->lock);
+  ip->next = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
   release(&itable.lock);
 
   return ip;
@@ -277,9 +473,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -306,6 +504,9 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->ranext = 0;
+    ip->rawin = 0;
+    ip->raend = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -324,7 +525,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
-// be recycled.
+// be recycled, least recently released entries first.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -332,7 +533,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -341,7 +544,7 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
     itrunc(ip);
     ip->type = 0;
@@ -350,11 +553,19 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
   }
 
-  ip->ref--;
-  release(&itable.lock);
+  if(--ip->ref == 0){
+    // an entry that no longer holds an inode
+    // is the first to be recycled.
+    acquire(&itable.lrulock);
+    if(ip->lnext)
+      lrudel(ip);
+    lruadd(ip, !ip->valid);
+    release(&itable.lrulock);
+  }
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -370,48 +581,100 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
-
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// listed in block ip->addrs[NDIRECT]. The next NDINDIRECT
+// blocks are listed in the NINDIRECT blocks that are in turn
+// listed in the double-indirect block ip->addrs[NDIRECT+1].
+
+// Return the nth entry of indirect block addr,
+// allocating a block for it if necessary and alloc is set.
+// A new block goes after the block of entry n-1, or after
+// the indirect block itself.
 static uint
-bmap(struct inode *ip, uint bn)
+indirect(struct inode *ip, uint addr, uint n, int alloc)
 {
-  uint addr, *a;
+  uint *a;
   struct buf *bp;
 
+  if(addr == 0)
+    return 0;
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if(a[n] == 0 && alloc){
+    a[n] = balloc(ip->dev, n > 0 && a[n-1] ? a[n-1] : addr);
+    log_write(bp);
+  }
+  addr = a[n];
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one if alloc
+// is set, and otherwise returns 0: the block is a hole,
+// which reads as zeroes. A new block goes just after the
+// file's previous one, where the disk has room.
+// Caller must hold ip->lock.
+uint
+bmap(struct inode *ip, uint bn, int alloc)
+{
+  uint addr;
+
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0 && alloc)
+      ip->addrs[bn] = addr = balloc(ip->dev, bn > 0 ? ip->addrs[bn-1] : 0);
     return addr;
   }
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+    if((addr = ip->addrs[NDIRECT]) == 0 && alloc)
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, ip->addrs[NDIRECT-1]);
+    return indirect(ip, addr, bn, alloc);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect
+    // block it points to, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0 && alloc)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev, ip->addrs[NDIRECT]);
+    addr = indirect(ip, addr, bn / NINDIRECT, alloc);
+    return indirect(ip, addr, bn % NINDIRECT, alloc);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists,
+// recursing depth more levels.
+static void
+itrunc_indirect(struct inode *ip, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 0)
+      itrunc_indirect(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -421,17 +684,18 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    itrunc_indirect(ip, ip->addrs[NDIRECT], 0);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    itrunc_indirect(ip, ip->addrs[NDIRECT+1], 1);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  pinval(ip);
+  if(ip->type == T_DIR)
+    dcachepurge(ip);
   ip->size = 0;
   iupdate(ip);
 }
@@ -448,6 +712,60 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading the blocks that a read of n bytes at off will
+// need, and, if the read continues where the previous read of ip
+// stopped, up to ip->rawin blocks beyond it. The window doubles
+// with each sequential read, up to RAMAX blocks, and drops to
+// zero on a non-sequential read.
+// Caller must hold ip->lock; n must be positive and off+n
+// must not exceed ip->size.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, first, last, end, addr, start, len;
+
+  first = off / BSIZE;
+  last = (off + n - 1) / BSIZE;
+  // reading the rest of a partly read block is sequential too.
+  if(first == ip->ranext || first + 1 == ip->ranext){
+    if(ip->rawin == 0)
+      ip->rawin = RAMIN;
+    else if(ip->rawin < RAMAX)
+      ip->rawin *= 2;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+
+  end = min(last + 1 + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  // readi() reads the first block right away. Blocks of
+  // cached pages need no reading; the page cache picks up
+  // the others from the buffer cache when it fills their pages.
+  // Blocks that are consecutive on the disk are prefetched
+  // together, as one disk request.
+  bn = first + 1;
+  if(bn < ip->raend)
+    bn = ip->raend;
+  start = len = 0;
+  for(; bn < end; bn++){
+    if(pcached(ip, bn / (PGSIZE / BSIZE)) || (addr = bmap(ip, bn, 0)) == 0)
+      continue;
+    if(len > 0 && addr == start + len){
+      len++;
+      continue;
+    }
+    if(len > 0)
+      bprefetch(ip->dev, start, len);
+    start = addr;
+    len = 1;
+  }
+  if(len > 0)
+    bprefetch(ip->dev, start, len);
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -456,22 +774,24 @@ int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  struct page *pg;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
+    pg = pget(ip, off/PGSIZE);
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(either_copyout(user_dst, dst, pg->data + (off % PGSIZE), m) == -1) {
+      prelse(pg);
       tot = -1;
       break;
     }
-    brelse(bp);
+    prelse(pg);
   }
   return tot;
 }
@@ -495,12 +815,13 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
+    pupdate(ip, off, bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -524,39 +845,112 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directories.
+//
+// A hashed directory's blocks form levels 0, 1, 2, ..., level k
+// being the 2^k blocks from block 2^k-1. dirlink() puts a name in
+// the first level whose block for it, DIRBLOCK(hash, k), has a
+// free entry, so a lookup reads one block per level, and a
+// directory of n entries has about log2(n/DPB) levels. Blocks
+// no entry has been put in are holes, which read as zeroes and
+// take no disk space. Other directories are searched from start
+// to end.
+
+// Look for name among the entries in [off, end) of dp.
+// Return its inode number, setting *poff to its offset, or 0.
+static uint
+dirscan(struct inode *dp, char *name, uint off, uint end, uint *poff)
+{
+  struct dirent de;
+
+  for(; off < end; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirscan read");
+    if(de.inum == 0)
+      continue;
+    if(namecmp(name, de.name) == 0){
+      // entry matches path element
+      *poff = off;
+      return de.inum;
+    }
+  }
+  return 0;
+}
+
+// Return the offset of the first free entry in [off, end)
+// of dp, or -1.
+static int
+dirfree(struct inode *dp, uint off, uint end)
+{
+  struct dirent de;
+
+  for(; off < end; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirfree read");
+    if(de.inum == 0)
+      return off;
+  }
+  return -1;
+}
+
+// Number of levels of hashed directory dp.
+static uint
+dirlevels(struct inode *dp)
+{
+  uint k, nblocks = (dp->size + BSIZE - 1) / BSIZE;
+
+  for(k = 0; (1U << k) - 1 < nblocks; k++)
+    ;
+  return k;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// The dcache remembers what earlier lookups found.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint off, inum, k, h, bn, levels;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(dcachelookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  inum = 0;
+  if(dp->major == DIRHASH){
+    h = dirhash(name);
+    levels = dirlevels(dp);
+    for(k = 0; k < levels && inum == 0; k++){
+      bn = DIRBLOCK(h, k);
+      inum = dirscan(dp, name, bn*BSIZE, min((bn+1)*BSIZE, dp->size), &off);
     }
+  } else {
+    inum = dirscan(dp, name, 0, dp->size, &off);
   }
 
-  return 0;
+  dcacheenter(dp, name, inum, inum ? off : 0);
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// Returns 0, or -1 if name is already there or, in a hashed
+// directory, the name's block is full at every level.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
+  uint h, k, bn, end;
   struct dirent de;
   struct inode *ip;
 
@@ -566,18 +960,35 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  off = -1;
+  if(dp->major == DIRHASH){
+    // Look for an empty dirent in the name's block of
+    // each level, adding a level if all are full. The
+    // directory grows to the end of the level, over holes.
+    h = dirhash(name);
+    for(k = 0; off < 0; k++){
+      bn = DIRBLOCK(h, k);
+      end = ((1U << (k+1)) - 1) * BSIZE;
+      if(end / BSIZE > MAXFILE)
+        return -1;
+      if(bn*BSIZE >= dp->size)
+        off = bn*BSIZE;
+      else
+        off = dirfree(dp, bn*BSIZE, min((bn+1)*BSIZE, dp->size));
+      if(off >= 0 && dp->size < end)
+        dp->size = end;
+    }
+  } else {
+    // Look for an empty dirent.
+    if((off = dirfree(dp, 0, dp->size)) < 0)
+      off = dp->size;
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
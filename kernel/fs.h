@@ -24,18 +24,19 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEVICE only)
+  short major;          // Major device number (T_DEVICE), or DIRHASH (T_DIR)
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +59,24 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory whose major is DIRHASH places each entry in a
+// block chosen by hashing its name; see dirlookup() in fs.c.
+// Otherwise its entries are in no particular order.
+#define DIRHASH 1
+
+// Entries per directory block.
+#define DPB (BSIZE / sizeof(struct dirent))
+
+// Block of a hashed directory for a name with hash h at level k.
+#define DIRBLOCK(h, k) ((1U << (k)) - 1 + (h) % (1U << (k)))
+
+// FNV-1a hash of a directory entry name.
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261U;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619U;
+  return h;
+}
@@ -1,6 +1,19 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own list of free pages, so kalloc() and
+// kfree() usually take only the calling CPU's lock. Pages move
+// between a CPU's list and the global pool KBATCH at a time:
+// an empty CPU list is refilled from the pool, and a CPU list
+// that grows past KHIGH pages gives a batch back. If both a CPU's
+// list and the pool are empty, kalloc() steals half of another
+// CPU's list.
+//
+// Each page also has a reference count, so that fork() can share
+// pages copy-on-write; kfree() frees a page only when the last
+// reference goes away. The counts are updated with atomic
+// instructions rather than under a lock.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +22,9 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCH 32           // pages moved between a CPU list and the pool
+#define KHIGH  (2*KBATCH)   // a CPU list longer than this gives back a batch
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,15 +34,24 @@ struct run {
   struct run *next;
 };
 
-struct {
+struct freelist {
   struct spinlock lock;
-  struct run *freelist;
-} kmem;
+  struct run *head;
+  int n;            // number of pages on the list
+};
+
+struct freelist kmem;        // global pool
+struct freelist kcpu[NCPU];  // per-CPU lists
+
+int refcnt[(PHYSTOP-KERNBASE)/PGSIZE];  // references to each page
+#define REFCNT(pa) refcnt[((uint64)(pa) - KERNBASE) / PGSIZE]
 
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpu[i].lock, "kmem_cpu");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +60,115 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    REFCNT(p) = 1;
     kfree(p);
+  }
+}
+
+// Detach up to n pages from the front of fl, which must be locked.
+// Returns the first page of the chain, and sets *tailp to the
+// last page and *np to the number of pages detached.
+static struct run*
+detach(struct freelist *fl, int n, struct run **tailp, int *np)
+{
+  struct run *head, *r;
+  int i;
+
+  head = r = fl->head;
+  if(r == 0 || n <= 0){
+    *np = 0;
+    return 0;
+  }
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  fl->head = r->next;
+  fl->n -= i;
+  r->next = 0;
+  *tailp = r;
+  *np = i;
+  return head;
+}
+
+// Push the chain head..tail of n pages onto fl.
+static void
+attach(struct freelist *fl, struct run *head, struct run *tail, int n)
+{
+  acquire(&fl->lock);
+  tail->next = fl->head;
+  fl->head = head;
+  fl->n += n;
+  release(&fl->lock);
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Find free pages for CPU id, whose own list is empty: first
+// a batch from the global pool, otherwise half of some other
+// CPU's list. Returns one page and puts the rest on CPU id's list.
+// Called with interrupts off and no locks held.
+static struct run*
+refill(int id)
+{
+  struct run *r, *tail;
+  struct freelist *victim;
+  int i, n;
+
+  acquire(&kmem.lock);
+  r = detach(&kmem, KBATCH, &tail, &n);
+  release(&kmem.lock);
+
+  for(i = 1; r == 0 && i < NCPU; i++){
+    victim = &kcpu[(id + i) % NCPU];
+    acquire(&victim->lock);
+    r = detach(victim, (victim->n + 1) / 2, &tail, &n);
+    release(&victim->lock);
+  }
+
+  if(r && n > 1)
+    attach(&kcpu[id], r->next, tail, n - 1);
+  return r;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *head, *tail;
+  struct freelist *fl;
+  int n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(&REFCNT(pa), 1);
+  if(n < 0)
+    panic("kfree: refcnt");
+  if(n > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  fl = &kcpu[cpuid()];
+  acquire(&fl->lock);
+  r->next = fl->head;
+  fl->head = r;
+  fl->n++;
+  head = 0;
+  if(fl->n > KHIGH)
+    head = detach(fl, KBATCH, &tail, &n);
+  release(&fl->lock);
+
+  // give a batch back to the pool.
+  if(head)
+    attach(&kmem, head, tail, n);
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +178,60 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct freelist *fl;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  fl = &kcpu[id];
+  acquire(&fl->lock);
+  r = fl->head;
+  if(r){
+    fl->head = r->next;
+    fl->n--;
+  }
+  release(&fl->lock);
 
-  if(r)
+  if(r == 0)
+    r = refill(id);
+  pop_off();
+
+  if(r){
+    REFCNT(r) = 1;
     memset((char*)r, 5, PGSIZE); // fill with junk
+  }
   return (void*)r;
 }
+
+// Add a reference to an allocated page.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  __sync_fetch_and_add(&REFCNT(pa), 1);
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&REFCNT(pa), __ATOMIC_SEQ_CST);
+}
+
+// Return the number of free pages.
+int
+kfreepages(void)
+{
+  int i, n;
+
+  acquire(&kmem.lock);
+  n = kmem.n;
+  release(&kmem.lock);
+  for(i = 0; i < NCPU; i++){
+    acquire(&kcpu[i].lock);
+    n += kcpu[i].n;
+    release(&kcpu[i].lock);
+  }
+  return n;
+}
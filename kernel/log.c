@@ -17,9 +17,27 @@
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
+// the count of in-progress FS system calls and reserves
+// log space for MAXOPBLOCKS blocks, and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// A system call that writes more, such as a large write(),
+// reserves more with begin_opn()/end_opn().
+//
+// The log's size comes from the superblock, up to LOGSIZE
+// blocks plus the header block.
+//
+// Commits are double-buffered. When the last outstanding
+// end_op() commits, it first copies the transaction's blocks
+// from the buffer cache into private buffers (log.cbuf[]),
+// which is quick, and only new begin_op()s must wait for that.
+// Then new system calls start collecting the next transaction
+// in log.lh while the committer writes the copies to the log
+// and to their home locations. The next transaction is
+// committed once the current commit is done, by the same
+// committer if no system calls are outstanding by then.
+// Home locations are written only from the private copies,
+// so a commit never writes a later transaction's updates.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +46,9 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A commit starts all of its log writes before waiting for any,
+// and the log blocks, being consecutive, go to the disk as
+// requests of up to MAXSEG blocks each.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,9 +62,17 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by outstanding sys calls.
+  int committing;  // a commit() is in progress.
+  int copying;     // commit() is copying log.lh's blocks, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // transaction collecting log_write()s
+  struct logheader clh; // transaction being committed
+
+  // for the transaction being committed, private copies of
+  // its blocks, and the cached blocks it keeps pinned.
+  struct buf cbuf[LOGSIZE];
+  struct buf *pinned[LOGSIZE];
 };
 struct log log;
 
@@ -60,25 +88,50 @@ initlog(int dev, struct superblock *sb)
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  if (log.size > LOGSIZE + 1)
+    log.size = LOGSIZE + 1; // the header can't name more blocks
+  if (log.size - 1 < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
+
+  uchar *data = 0;
+  for (int i = 0; i < log.size - 1; i++) {
+    if (i % (PGSIZE / BSIZE) == 0 && (data = kalloc()) == 0)
+      panic("initlog: kalloc");
+    initsleeplock(&log.cbuf[i].lock, "logbuf");
+    log.cbuf[i].dev = dev;
+    log.cbuf[i].data = data + (i % (PGSIZE / BSIZE)) * BSIZE;
+  }
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from the on-disk log to their home
+// location. Used only by recovery; commit() installs from
+// its private copies instead.
+// The writes are started a batch at a time, so that the
+// batch fits on the kernel stack.
 static void
-install_trans(int recovering)
+install_trans(void)
 {
-  int tail;
+  int tail, i, n;
+  struct buf *dbuf[32];
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.clh.n; tail += n) {
+    n = log.clh.n - tail;
+    if (n > NELEM(dbuf))
+      n = NELEM(dbuf);
+    bprefetch(log.dev, log.start+tail+1, n); // read the batch's log blocks
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbuf[i] = bread(log.dev, log.clh.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bstartv(dbuf, n, 1);  // write dsts to disk
+    for (i = 0; i < n; i++) {
+      bwait(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -89,9 +142,9 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -105,9 +158,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,42 +170,64 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  install_trans(); // if committed, copy from log to disk
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// The most blocks a single FS system call may reserve.
+int
+log_maxop(void)
+{
+  int n = (log.size - 1) / 2;
+
+  return n < MAXOPBLOCKS ? MAXOPBLOCKS : n;
+}
+
+// called at the start of each FS system call
+// that writes up to n blocks; n must not exceed log_maxop().
 void
-begin_op(void)
+begin_opn(int n)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.copying){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.size - 1){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call,
+// with the n passed to begin_opn().
+// commits if this was the last outstanding operation,
+// unless another commit is in progress, in which case
+// that commit's committer picks up this transaction.
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= n;
+  if(log.copying)
+    panic("log.copying");
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -167,44 +242,96 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Move log.lh to log.clh, copying each of its blocks from
+// the cache into the private buffers. Caller has set
+// log.copying, so no FS system call is running.
 static void
-write_log(void)
+copy_trans(void)
 {
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    acquiresleep(&log.cbuf[tail].lock);
+    memmove(log.cbuf[tail].data, from->data, BSIZE);
+    log.pinned[tail] = from;  // still pinned by log_write()
     brelse(from);
-    brelse(to);
+    log.clh.block[tail] = log.lh.block[tail];
+  }
+  log.clh.n = log.lh.n;
+}
+
+// Write the private copies of the committing transaction's
+// blocks to the log, or to their home locations if home is set.
+// All the writes are in flight at once; bstartv() merges
+// writes of consecutive blocks.
+static void
+write_copies(int home)
+{
+  int tail, i, n;
+  struct buf *bs[32];
+
+  for (tail = 0; tail < log.clh.n; tail += n) {
+    n = log.clh.n - tail;
+    if (n > NELEM(bs))
+      n = NELEM(bs);
+    for (i = 0; i < n; i++) {
+      bs[i] = &log.cbuf[tail+i];
+      bs[i]->blockno = home ? log.clh.block[tail+i] : log.start+tail+i+1;
+    }
+    bstartv(bs, n, 1);
   }
+  for (tail = 0; tail < log.clh.n; tail++)
+    bwait(&log.cbuf[tail]);
 }
 
+// Commit transactions until none is ready.
+// Caller has set log.committing.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  int tail;
+
+  acquire(&log.lock);
+  while (log.outstanding == 0 && log.lh.n > 0) {
+    log.copying = 1;
+    release(&log.lock);
+    copy_trans();
+    acquire(&log.lock);
     log.lh.n = 0;
+    log.copying = 0;
+    wakeup(&log);   // new system calls may begin
+    release(&log.lock);
+
+    write_copies(0); // Write the private copies to the log
+    write_head();    // Write header to disk -- the real commit
+    write_copies(1); // Now install writes to home locations
+    for (tail = 0; tail < log.clh.n; tail++) {
+      bunpin(log.pinned[tail]);
+      releasesleep(&log.cbuf[tail].lock);
+    }
+    log.clh.n = 0;
     write_head();    // Erase the transaction from the log
+
+    acquire(&log.lock);
   }
+  log.committing = 0;
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/copy_trans() will copy it and do the disk writes.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -233,4 +360,3 @@ log_write(struct buf *b)
   }
   release(&log.lock);
 }
-
@@ -21,11 +21,14 @@ main()
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
+    timerwheelinit(); // per-hart timer wheels
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    pinit();         // file page cache
     iinit();         // inode table
+    dcacheinit();    // directory name cache
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
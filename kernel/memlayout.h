@@ -27,6 +27,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -62,6 +63,12 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   URING (the uring, if uringsetup() has made one)
+//   VDSOPROC (read-only struct vdsoproc, p->vdsoproc)
+//   VDSO (read-only struct vdso, the same page in every process)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define VDSO (TRAPFRAME - PGSIZE)
+#define VDSOPROC (VDSO - PGSIZE)
+#define URING (VDSOPROC - PGSIZE)
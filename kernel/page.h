@@ -0,0 +1,11 @@
+struct page {
+  uint dev;
+  uint inum;
+  uint pgno;           // page number within the file
+  int valid;           // has data been read from the file?
+  uint refcnt;
+  int used;            // released since the CLOCK hand last passed?
+  struct page *next;   // hash bucket chain
+  struct page *cnext;  // ring of all pages, for the CLOCK hand
+  char *data;          // PGSIZE bytes
+};
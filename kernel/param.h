@@ -1,13 +1,18 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // demand-paged regions per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE      500  // maximum number of cached i-nodes
+#define NDCACHE     512  // directory name cache entries
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXSEG       16  // max # of blocks in one disk request
+#define LOGSIZE      254  // max data blocks in on-disk log (one header block's worth)
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BUFMEM       16  // disk block cache gets 1/BUFMEM of free memory
+#define PCACHEMEM    8   // file page cache gets 1/PCACHEMEM of free memory
+#define FSSIZE       10000  // default size of file system in blocks
 #define MAXPATH      128   // maximum file path name
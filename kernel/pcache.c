@@ -0,0 +1,308 @@
+// Page cache.
+//
+// The page cache holds file contents a page at a time, hashed
+// by (dev, inum, page number), so that reading a recently read
+// file doesn't go to the disk, and file data doesn't push file
+// system metadata out of the buffer cache.
+//
+// readi() reads through the page cache. writei() still writes
+// through the buffer cache and the log, and copies what it
+// writes into the file's cached page, if there is one; so a
+// cached page is never newer than the file, and a page can be
+// dropped at any time. Pages are filled from the disk without
+// passing through the buffer cache, except for blocks that the
+// buffer cache holds, which may be newer than the disk.
+// itrunc() drops a file's pages.
+//
+// The exception is a page that a MAP_SHARED mapping maps, which
+// holds the mapping's stores until they are written back, so
+// that every mapping of the file, and read() and write(), see
+// the same bytes. Such a page has a kalloc() reference for each
+// mapping as well as the cache's own, and isn't recycled until
+// the last mapping goes. If itrunc() drops it first, mappings
+// made after the truncation get a new page.
+//
+// Only valid pages are on the hash chains. pcache.lock protects
+// the chains and the valid, refcnt and used fields. A page's data
+// is used only under the lock of the page's inode, and so is a
+// page while it is being filled. Unused pages are recycled in
+// CLOCK order.
+//
+// Interface:
+// * To get a file's page, filled in, call pget; call prelse
+//     when done with it.
+// * To keep a cached page up to date with a write, call pupdate.
+// * To map a file's page in a shared mapping, call pmap.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+#include "page.h"
+
+#define NPBUCKET 1021
+#define BPP (PGSIZE / BSIZE)  // blocks per page
+
+struct {
+  struct spinlock lock;
+  int npage;                 // number of pages, set by pinit()
+  struct page *bucket[NPBUCKET];
+  struct page *hand;         // CLOCK hand, on the ring through page.cnext
+} pcache;
+
+static struct page**
+phash(uint dev, uint inum, uint pgno)
+{
+  return &pcache.bucket[(pgno ^ (inum << 8) ^ (dev << 24)) % NPBUCKET];
+}
+
+// Allocate the pages, 1/PCACHEMEM of the memory that is still
+// free. The page structures come from kalloc()ed pages too.
+void
+pinit(void)
+{
+  struct page *pg, *prev;
+  int i, npage;
+
+  initlock(&pcache.lock, "pcache");
+  npage = kfreepages() / PCACHEMEM;
+  if(npage < NPROC)
+    npage = NPROC;  // every process can read at once.
+
+  pg = prev = 0;
+  for(i = 0; i < npage; i++){
+    if(i % (PGSIZE / sizeof(struct page)) == 0){
+      if((pg = (struct page*)kalloc()) == 0)
+        panic("pinit");
+      memset(pg, 0, PGSIZE);
+    }
+    if((pg->data = kalloc()) == 0)
+      panic("pinit");
+    if(prev)
+      prev->cnext = pg;
+    else
+      pcache.hand = pg;
+    prev = pg;
+    pg++;
+  }
+  prev->cnext = pcache.hand;
+  pcache.npage = npage;
+}
+
+// Look for a page of a file in its hash chain.
+// Caller must hold pcache.lock.
+static struct page*
+pfind(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+
+  for(pg = *phash(dev, inum, pgno); pg != 0; pg = pg->next){
+    if(pg->dev == dev && pg->inum == inum && pg->pgno == pgno)
+      return pg;
+  }
+  return 0;
+}
+
+// Mark pg valid, and put it on its hash chain.
+// Caller must hold pcache.lock.
+static void
+pvalid(struct page *pg)
+{
+  struct page **bk = phash(pg->dev, pg->inum, pg->pgno);
+
+  pg->valid = 1;
+  pg->next = *bk;
+  *bk = pg;
+}
+
+// Mark pg invalid, and take it off its hash chain, if it's on one.
+// Caller must hold pcache.lock.
+static void
+pinvalid(struct page *pg)
+{
+  struct page **pp;
+
+  if(!pg->valid)
+    return;
+  for(pp = phash(pg->dev, pg->inum, pg->pgno); *pp != pg; pp = &(*pp)->next)
+    ;
+  *pp = pg->next;
+  pg->valid = 0;
+}
+
+// Choose an unused page to recycle, using the CLOCK algorithm,
+// as bvictim() does for buffers.
+// Caller must hold pcache.lock.
+static struct page*
+pvictim(void)
+{
+  struct page *pg;
+  int i;
+
+  for(i = 0; i < 2*pcache.npage; i++){
+    pg = pcache.hand;
+    pcache.hand = pg->cnext;
+    if(pg->refcnt == 0 && krefcnt(pg->data) == 1){
+      if(pg->used)
+        pg->used = 0;
+      else
+        return pg;
+    }
+  }
+  panic("pget: no pages");
+}
+
+// Read page pg of ip from the disk, or from the buffer cache
+// for blocks it holds. All the disk reads are in flight at once,
+// consecutive blocks in one request.
+// Caller must hold ip->lock.
+static void
+pfill(struct inode *ip, struct page *pg)
+{
+  struct buf b[BPP], *rd[BPP];
+  uint bn;
+  int i, nrd;
+
+  nrd = 0;
+  for(i = 0; i < BPP; i++){
+    bn = pg->pgno * BPP + i;
+    if(bn * BSIZE >= ip->size || (b[i].blockno = bmap(ip, bn, 0)) == 0){
+      memset(pg->data + i*BSIZE, 0, BSIZE);
+      continue;
+    }
+    b[i].dev = ip->dev;
+    b[i].data = (uchar*)pg->data + i*BSIZE;
+    if(bpeek(b[i].dev, b[i].blockno, b[i].data) == 0)
+      rd[nrd++] = &b[i];
+  }
+  bstartv(rd, nrd, 0);
+  for(i = 0; i < nrd; i++)
+    virtio_disk_wait(rd[i]);
+}
+
+// Return page pgno of ip, filled in.
+// Caller must hold ip->lock.
+struct page*
+pget(struct inode *ip, uint pgno)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pfind(ip->dev, ip->inum, pgno)) == 0){
+    pg = pvictim();
+    pinvalid(pg);
+    pg->dev = ip->dev;
+    pg->inum = ip->inum;
+    pg->pgno = pgno;
+  }
+  pg->refcnt++;
+  release(&pcache.lock);
+
+  if(!pg->valid){
+    pfill(ip, pg);
+    acquire(&pcache.lock);
+    pvalid(pg);
+    release(&pcache.lock);
+  }
+  return pg;
+}
+
+// Release a page from pget().
+void
+prelse(struct page *pg)
+{
+  acquire(&pcache.lock);
+  pg->refcnt--;
+  if(pg->refcnt == 0)
+    pg->used = 1;
+  release(&pcache.lock);
+}
+
+// Count the pages that mappings hold.
+// Caller must hold pcache.lock.
+static int
+pmapped(void)
+{
+  struct page *pg = pcache.hand;
+  int i, n = 0;
+
+  for(i = 0; i < pcache.npage; i++, pg = pg->cnext)
+    if(krefcnt(pg->data) > 1)
+      n++;
+  return n;
+}
+
+// Return the data of page pgno of ip, filled in, with a
+// kalloc() reference for a shared mapping to map; unmapping it
+// kfree()s the reference. Mappings may hold all but NPROC pages,
+// so that every process can still read at once.
+// Returns 0 if too many pages are mapped.
+// Caller must hold ip->lock.
+char*
+pmap(struct inode *ip, uint pgno)
+{
+  struct page *pg;
+  char *pa = 0;
+
+  pg = pget(ip, pgno);
+  acquire(&pcache.lock);
+  if(krefcnt(pg->data) > 1 || pmapped() < pcache.npage - NPROC){
+    pa = pg->data;
+    kref(pa);
+  }
+  release(&pcache.lock);
+  prelse(pg);
+  return pa;
+}
+
+// Is page pgno of ip cached?
+int
+pcached(struct inode *ip, uint pgno)
+{
+  int r;
+
+  acquire(&pcache.lock);
+  r = pfind(ip->dev, ip->inum, pgno) != 0;
+  release(&pcache.lock);
+  return r;
+}
+
+// writei() has written n bytes at off in ip, from src, within
+// one block. Copy them to the cached page, if any.
+// Caller must hold ip->lock.
+void
+pupdate(struct inode *ip, uint off, uchar *src, uint n)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pfind(ip->dev, ip->inum, off / PGSIZE)) != 0)
+    pg->refcnt++;
+  release(&pcache.lock);
+  if(pg){
+    memmove(pg->data + off % PGSIZE, src, n);
+    prelse(pg);
+  }
+}
+
+// Drop ip's cached pages, which itrunc() has made stale.
+// Caller must hold ip->lock.
+void
+pinval(struct inode *ip)
+{
+  struct page *pg;
+  int i;
+
+  acquire(&pcache.lock);
+  pg = pcache.hand;
+  for(i = 0; i < pcache.npage; i++, pg = pg->cnext){
+    if(pg->valid && pg->dev == ip->dev && pg->inum == ip->inum)
+      pinvalid(pg);
+  }
+  release(&pcache.lock);
+}
@@ -8,17 +8,38 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// A pipe's data is a ring of PIPEPAGES pages. Readers and
+// writers copy whole contiguous spans of a page at a time, and
+// only wake each other when the pipe stops being empty or full,
+// which is when the other side may be waiting.
+//
+// vmsplice() moves whole, page-aligned pages instead of copying
+// them: the writer's page takes the place of a ring page, shared
+// copy-on-write with the writer, and a reader's page is replaced
+// by the ring page, which the ring replaces with a fresh one.
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int nrsleep;    // readers sleeping for data
+  int nwsleep;    // writers sleeping for space
 };
 
+static void
+pipefree(struct pipe *pi)
+{
+  for(int i = 0; i < PIPEPAGES; i++)
+    if(pi->data[i])
+      kfree(pi->data[i]);
+  kfree((char*)pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,6 +51,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  for(int i = 0; i < PIPEPAGES; i++)
+    if((pi->data[i] = kalloc()) == 0)
+      goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -47,7 +72,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +93,46 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
-int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+// The longest span of the ring from byte offset off that
+// lies within one page and is at most n bytes.
+static uint
+span(uint off, uint n)
+{
+  uint m = PGSIZE - off % PGSIZE;
+
+  return n < m ? n : m;
+}
+
+// Make ring page i the pipe's own, if a page moved in by
+// vmsplice() is still shared with its writer.
+static int
+pipeown(struct pipe *pi, int i)
+{
+  char *mem;
+
+  if(krefcnt(pi->data[i]) == 1)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, pi->data[i], PGSIZE);
+  kfree(pi->data[i]);
+  pi->data[i] = mem;
+  return 0;
+}
+
+// Write n bytes from user address addr to the pipe. If remap
+// is set, move page-aligned whole pages rather than copy them.
+static int
+pipewrite1(struct pipe *pi, uint64 addr, int n, int remap)
 {
   int i = 0;
+  uint off, m;
+  uint64 pa;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -86,28 +142,45 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       return -1;
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+      pi->nwsleep++;
       sleep(&pi->nwrite, &pi->lock);
+      pi->nwsleep--;
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      off = pi->nwrite % PIPESIZE;
+      m = span(off, n - i);
+      if(m > pi->nread + PIPESIZE - pi->nwrite)
+        m = pi->nread + PIPESIZE - pi->nwrite;
+      if(remap && m == PGSIZE && (addr + i) % PGSIZE == 0 &&
+         (pa = uvmcowpage(pr, addr + i)) != 0){
+        // the ring page is free; put the user's page there.
+        kfree(pi->data[off / PGSIZE]);
+        pi->data[off / PGSIZE] = (char*)pa;
+      } else {
+        if(pipeown(pi, off / PGSIZE) < 0)
+          break;
+        if(copyin(pr->pagetable, pi->data[off / PGSIZE] + off % PGSIZE, addr + i, m) == -1)
+          break;
+      }
+      if(pi->nwrite == pi->nread && pi->nrsleep)
+        wakeup(&pi->nread);  // no longer empty
+      pi->nwrite += m;
+      i += m;
     }
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
 }
 
-int
-piperead(struct pipe *pi, uint64 addr, int n)
+// Read up to n bytes from the pipe to user address addr. If
+// remap is set, move page-aligned whole pages rather than copy them.
+static int
+piperead1(struct pipe *pi, uint64 addr, int n, int remap)
 {
   int i;
+  uint off, m;
+  char *mem;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -115,16 +188,55 @@ piperead(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
+    pi->nrsleep++;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    pi->nrsleep--;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  i = 0;
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    off = pi->nread % PIPESIZE;
+    m = span(off, n - i);
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(remap && m == PGSIZE && (addr + i) % PGSIZE == 0 && (mem = kalloc()) != 0){
+      // the whole ring page is being read; give it to the
+      // reader, and put a fresh page in the ring.
+      if(uvmremap(pr, addr + i, (uint64)pi->data[off / PGSIZE]) == 0){
+        pi->data[off / PGSIZE] = mem;
+      } else {
+        kfree(mem);
+        if(copyout(pr->pagetable, addr + i, pi->data[off / PGSIZE], m) == -1)
+          break;
+      }
+    } else if(copyout(pr->pagetable, addr + i, pi->data[off / PGSIZE] + off % PGSIZE, m) == -1)
       break;
+    if(pi->nwrite == pi->nread + PIPESIZE && pi->nwsleep)
+      wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+    pi->nread += m;
+    i += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+int
+pipewrite(struct pipe *pi, uint64 addr, int n)
+{
+  return pipewrite1(pi, addr, n, 0);
+}
+
+int
+piperead(struct pipe *pi, uint64 addr, int n)
+{
+  return piperead1(pi, addr, n, 0);
+}
+
+// Like pipewrite() or piperead(), but move whole pages where
+// the user buffer and the ring are both page-aligned.
+int
+pipevmsplice(struct pipe *pi, uint64 addr, int n, int write)
+{
+  if(write)
+    return pipewrite1(pi, addr, n, 1);
+  return piperead1(pi, addr, n, 1);
+}
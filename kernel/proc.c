@@ -5,11 +5,49 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vdso.h"
 
 struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
+// Scheduling is a multilevel feedback queue. Each CPU has a run
+// queue of RUNNABLE processes for each priority level, and runs
+// the first process of the highest non-empty level, or steals
+// one from another CPU if its own queue is empty. A process that
+// uses up its time slice drops a level, and each level's slice is
+// twice the one above. A process that wakes up having used none of
+// its current slice, as interactive and I/O-bound ones do, rises a
+// level. Every BOOSTTICKS ticks every process is raised to level
+// 0, so that CPU-bound processes don't starve.
+//
+// A CPU with nothing to run waits in wfi. Making a process
+// RUNNABLE sends an IPI to its CPU, or to some other idle CPU
+// that can steal it, if that CPU is idle.
+#define NLEVEL      3
+#define SLICE(l)    (1 << (l))  // time slice at level l, in ticks
+#define BOOSTTICKS  50
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NLEVEL];
+  struct proc *tail[NLEVEL];
+  uint boostgen;              // last boost applied to the queue
+};
+struct runq runq[NCPU];
+
+// Processes in sleep() are on a wait queue, chosen by hashing
+// the channel, so that wakeup() need look only at them. A wait
+// queue's lock is acquired before any p->lock.
+#define NWAITQ 61
+#define WAITQ(chan) (&waitq[(uint64)(chan) % NWAITQ])
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+};
+struct waitq waitq[NWAITQ];
+
 struct proc *initproc;
 
 int nextpid = 1;
@@ -17,6 +55,7 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void runqadd(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -50,6 +89,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -119,6 +162,9 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->level = 0;
+  p->slice = 0;
+  p->boostgen = ticks / BOOSTTICKS;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -127,6 +173,15 @@ found:
     return 0;
   }
 
+  // Allocate the page of per-process data user code may read.
+  if((p->vdsoproc = (struct vdsoproc *)kalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  memset(p->vdsoproc, 0, PGSIZE);
+  p->vdsoproc->pid = p->pid;
+
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
@@ -153,6 +208,9 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->vdsoproc)
+    kfree((void*)p->vdsoproc);
+  p->vdsoproc = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
@@ -196,6 +254,17 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the vdso pages below that, read-only for user code.
+  if(mappages(pagetable, VDSO, PGSIZE, (uint64)vdso, PTE_R | PTE_U) < 0 ||
+     mappages(pagetable, VDSOPROC, PGSIZE, (uint64)(p->vdsoproc), PTE_R | PTE_U) < 0){
+    if(walkaddr(pagetable, VDSO))
+      uvmunmap(pagetable, VDSO, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -206,6 +275,10 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, VDSO, 1, 0);
+  uvmunmap(pagetable, VDSOPROC, 1, 0);
+  if(walkaddr(pagetable, URING))
+    uvmunmap(pagetable, URING, 1, 1);
   uvmfree(pagetable, sz);
 }
 
@@ -242,7 +315,9 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
+  p->cpu = 0;
   p->state = RUNNABLE;
+  runqadd(p);
 
   release(&p->lock);
 }
@@ -261,7 +336,20 @@ growproc(int n)
       return -1;
     }
   } else if(n < 0){
+    // dirty pages of a shared mapping go back to the file first.
+    uint64 a = PGROUNDUP(sz + n);
+    for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+      if(v->ip && v->shared && v->end > a &&
+         vmawriteback(p->pagetable, v, v->start > a ? v->start : a, v->end) != 0)
+        return -1;
+    }
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // pages freed from a demand-paged region come
+    // back zeroed, not from the file, if sz grows again.
+    for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+      if(v->ip && v->end > PGROUNDUP(sz))
+        v->end = v->start > PGROUNDUP(sz) ? v->start : PGROUNDUP(sz);
+    }
   }
   p->sz = sz;
   return 0;
@@ -274,6 +362,8 @@ fork(void)
 {
   int i, pid;
   struct proc *np;
+  uint64 pa;
+  char *mem;
   struct proc *p = myproc();
 
   // Allocate process.
@@ -289,6 +379,19 @@ fork(void)
   }
   np->sz = p->sz;
 
+  // the child gets its own copy of the parent's uring.
+  if((pa = walkaddr(p->pagetable, URING)) != 0){
+    if((mem = kalloc()) == 0 ||
+       mappages(np->pagetable, URING, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+      if(mem)
+        kfree(mem);
+      freeproc(np);
+      release(&np->lock);
+      return -1;
+    }
+    memmove(mem, (char*)pa, PGSIZE);
+  }
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
 
@@ -307,12 +410,23 @@ fork(void)
 
   release(&np->lock);
 
+  // the child shares the parent's demand-paged regions.
+  // vmadup() may sleep, so this comes after np->lock is
+  // released; np can't run until it is RUNNABLE below.
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(p->vma[i].ip)
+      vmadup(&np->vma[i]);
+  }
+
   acquire(&wait_lock);
   np->parent = p;
   release(&wait_lock);
 
   acquire(&np->lock);
+  np->cpu = p->cpu;
   np->state = RUNNABLE;
+  runqadd(np);
   release(&np->lock);
 
   return pid;
@@ -353,8 +467,11 @@ exit(int status)
     }
   }
 
+  if(vmasync(p->pagetable, p->vma) != 0)
+    printf("exit: pid %d: lost stores to a shared mapping\n", p->pid);
   begin_op();
   iput(p->cwd);
+  vmaput(p->vma);
   end_op();
   p->cwd = 0;
 
@@ -387,6 +504,8 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  if(addr != 0)
+    uvmprefault(addr, sizeof(int), 1);  // copied out under np->lock
   acquire(&wait_lock);
 
   for(;;){
@@ -427,10 +546,129 @@ wait(uint64 addr)
   }
 }
 
+// Wake CPU id with an IPI if it is idle, so that it
+// looks at the run queues; otherwise wake some other
+// idle CPU, which can steal from CPU id's queue.
+static void
+kick(int id)
+{
+  int i;
+
+  // pairs with the fence in scheduler(): either it sees
+  // the new process on the queue, or we see it idle.
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++){
+    if(cpus[(id + i) % NCPU].idle){
+      *(uint32*)CLINT_MSIP((id + i) % NCPU) = 1;
+      return;
+    }
+  }
+}
+
+// Apply any priority boost that p hasn't had yet.
+// Caller must hold p->lock.
+static void
+boost(struct proc *p)
+{
+  uint gen = ticks / BOOSTTICKS;
+
+  if(p->boostgen != gen){
+    p->boostgen = gen;
+    p->level = 0;
+    p->slice = 0;
+  }
+}
+
+// Put p, which has just become RUNNABLE, at the tail
+// of its level on its CPU's run queue.
+// Caller must hold p->lock.
+static void
+runqadd(struct proc *p)
+{
+  struct runq *rq = &runq[p->cpu];
+
+  boost(p);
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail[p->level])
+    rq->tail[p->level]->rqnext = p;
+  else
+    rq->head[p->level] = p;
+  rq->tail[p->level] = p;
+  release(&rq->lock);
+  kick(p->cpu);
+}
+
+// Is CPU id's run queue empty? Takes no lock.
+static int
+runqempty(int id)
+{
+  for(int l = 0; l < NLEVEL; l++)
+    if(runq[id].head[l])
+      return 0;
+  return 1;
+}
+
+// Take the first process of the highest non-empty level
+// off CPU id's run queue. Returns 0 if the queue is empty.
+static struct proc*
+runqget(int id)
+{
+  struct runq *rq = &runq[id];
+  struct proc *p = 0;
+  uint gen = ticks / BOOSTTICKS;
+  int l;
+
+  // idle CPUs poll every queue, so first look without the lock.
+  if(runqempty(id))
+    return 0;
+
+  acquire(&rq->lock);
+  if(rq->boostgen != gen){
+    // a boost: move every level onto the end of level 0.
+    rq->boostgen = gen;
+    for(l = 1; l < NLEVEL; l++){
+      if(rq->head[l] == 0)
+        continue;
+      if(rq->tail[0])
+        rq->tail[0]->rqnext = rq->head[l];
+      else
+        rq->head[0] = rq->head[l];
+      rq->tail[0] = rq->tail[l];
+      rq->head[l] = rq->tail[l] = 0;
+    }
+  }
+  for(l = 0; l < NLEVEL; l++){
+    if((p = rq->head[l]) != 0){
+      rq->head[l] = p->rqnext;
+      if(rq->head[l] == 0)
+        rq->tail[l] = 0;
+      p->rqnext = 0;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Is a process of a higher level than l waiting on
+// CPU id's run queue? Only a hint; takes no lock.
+static int
+runqwaiting(int id, int l)
+{
+  struct runq *rq = &runq[id];
+
+  while(--l >= 0)
+    if(rq->head[l])
+      return 1;
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run: the next one on this CPU's
+//    run queue, or one from another CPU's queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -439,28 +677,55 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  int i;
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+    p = runqget(id);
+    for(i = 1; p == 0 && i < NCPU; i++)
+      p = runqget((id + i) % NCPU);
+    if(p == 0){
+      // nothing to run: wait for an interrupt, such as a
+      // timer tick or a kick(). wfi returns once one is
+      // pending even with interrupts off, and they are off
+      // so that one can't slip in between the check and wfi.
+      intr_off();
+      c->idle = 1;
+      __sync_synchronize();
+      for(i = 0; i < NCPU && runqempty(i); i++)
+        ;
+      if(i == NCPU){
+        uint64 t0 = r_time();
+        wfi();
+        c->idletime += r_time() - t0;
       }
-      release(&p->lock);
+      c->idle = 0;
+      continue;
+    }
+
+    // p is off every run queue, so nothing else will
+    // schedule it, though the CPU that last ran it may
+    // still hold p->lock until it is off p's stack.
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      boost(p);
+      p->state = RUNNING;
+      p->cpu = id;
+      c->proc = p;
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
     }
+    release(&p->lock);
   }
 }
 
@@ -498,10 +763,44 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  runqadd(p);
   sched();
   release(&p->lock);
 }
 
+// Called on each timer interrupt while the current process
+// runs. Charge the tick to its time slice, and give up the CPU
+// if the slice is used up, in which case the process drops a
+// level, or if a process of a higher level is waiting.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+
+  // p->level and p->slice only change while p runs,
+  // or under p->lock while it doesn't.
+  if(++p->slice >= SLICE(p->level)){
+    if(p->level < NLEVEL-1)
+      p->level++;
+    p->slice = 0;
+    yield();
+  } else if(runqwaiting(p->cpu, p->level)){
+    yield();
+  }
+}
+
+// p, which was SLEEPING, is now RUNNABLE.
+// If it slept without using any of its current time slice,
+// raise it a level. Caller must hold p->lock.
+static void
+wakeproc(struct proc *p)
+{
+  p->state = RUNNABLE;
+  if(p->slice == 0 && p->level > 0)
+    p->level--;
+  runqadd(p);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -529,6 +828,16 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = WAITQ(chan);
+  struct proc **pp;
+
+  // Join chan's wait queue while still holding lk,
+  // so that a wakeup() after lk is released will
+  // find p there.
+  acquire(&wq->lock);
+  p->wqnext = wq->head;
+  wq->head = p;
+  release(&wq->lock);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
@@ -548,9 +857,16 @@ sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // Leave the wait queue.
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp != p; pp = &(*pp)->wqnext)
+    ;
+  *pp = p->wqnext;
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -559,17 +875,22 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  struct waitq *wq = WAITQ(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  // the queue may also hold processes sleeping on other
+  // channels, and ones that have woken but not yet left.
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = p->wqnext) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        wakeproc(p);
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -586,7 +907,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        wakeproc(p);
       }
       release(&p->lock);
       return 0;
@@ -24,6 +24,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // In wfi in scheduler(), waiting for work?
+  uint64 idletime;            // Time spent idle, in r_time() cycles.
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,6 +84,22 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region of user memory that is filled in from a file page
+// by page, on first touch: bytes [off, off+filesz) of ip are
+// at start, and the rest of the region up to end is zero.
+// A shared region maps the file's cached pages instead, the
+// bytes past the end of the file included.
+struct vma {
+  uint64 start;                // page-aligned
+  uint64 end;
+  struct inode *ip;            // 0 if the slot is free
+  uint off;
+  uint filesz;
+  int perm;                    // PTE_R, PTE_W and PTE_X of its pages
+  int shared;                  // MAP_SHARED: stores go back to the file
+  int text;                    // an exec()ed segment, counted in ip->ntext
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -92,6 +110,10 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int level;                   // Scheduling priority level; 0 is highest
+  int slice;                   // Ticks run at this level
+  int cpu;                     // Run queue to put this process on
+  uint boostgen;               // Priority boost this process last got
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -101,8 +123,21 @@ struct proc {
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  struct vdsoproc *vdsoproc;   // read-only page at VDSOPROC
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Demand-paged regions, e.g. ELF segments
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next process on the run queue
+
+  // the wait queue's lock must be held when using this:
+  struct proc *wqnext;         // Next process on the wait queue
+
+  // the timer wheel's lock must be held when using these:
+  int timed;                   // If non-zero, on a timer wheel
+  uint expire;                 // Wheel tick at which to wake
+  struct proc *tnext;          // Next process in the wheel slot
   char name[16];               // Process name (debugging)
 };
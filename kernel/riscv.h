@@ -269,6 +269,14 @@ r_time()
   return x;
 }
 
+// wait for an interrupt: stall until one is pending,
+// even if interrupts are disabled.
+static inline void
+wfi()
+{
+  asm volatile("wfi");
+}
+
 // enable device interrupts
 static inline void
 intr_on()
@@ -343,6 +351,10 @@ sfence_vma()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_A (1L << 6)
+#define PTE_D (1L << 7) // dirty
+#define PTE_COW (1L << 8) // software bit: copy-on-write page
+#define PTE_SHARED (1L << 9) // software bit: page of a MAP_SHARED mapping
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
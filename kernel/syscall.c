@@ -104,6 +104,12 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_idletime(void);
+extern uint64 sys_vmsplice(void);
+extern uint64 sys_uringsetup(void);
+extern uint64 sys_uringenter(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,6 +133,12 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_idletime] sys_idletime,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_uringsetup] sys_uringsetup,
+[SYS_uringenter] sys_uringenter,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
 };
 
 void
@@ -20,3 +20,9 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_idletime 22
+#define SYS_vmsplice 23
+#define SYS_uringsetup 24
+#define SYS_uringenter 25
+#define SYS_mmap   26
+#define SYS_munmap 27
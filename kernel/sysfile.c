@@ -8,6 +8,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
 #include "stat.h"
 #include "spinlock.h"
 #include "proc.h"
@@ -15,6 +16,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uring.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -92,18 +94,41 @@ sys_write(void)
 }
 
 uint64
-sys_close(void)
+sys_vmsplice(void)
+{
+  struct file *f;
+  int n;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+    return -1;
+
+  return filevmsplice(f, p, n);
+}
+
+// Close file descriptor fd, for close() and the uring.
+static int
+fdclose(int fd)
 {
-  int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
     return -1;
   myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
 
+uint64
+sys_close(void)
+{
+  int fd;
+
+  if(argfd(0, &fd, 0) < 0)
+    return -1;
+  return fdclose(fd);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -218,6 +243,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -268,32 +294,43 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+      goto bad;
   }
 
+  // a hashed directory can run out of room for names with
+  // the same hash, so this can fail.
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto bad;
+
+  if(type == T_DIR){
+    // now that success is guaranteed:
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
   return ip;
+
+bad:
+  // free the new inode: iput() frees it with nlink 0.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with omode, for open() and the uring.
+// Returns the new file descriptor, or -1.
+static int
+openpath(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -322,6 +359,14 @@ sys_open(void)
     return -1;
   }
 
+  // a running program can't be written or truncated.
+  if(ip->type == T_FILE && ip->ntext > 0 &&
+     (omode & (O_WRONLY|O_RDWR|O_TRUNC))){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -340,6 +385,8 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  if(f->type == FD_INODE && f->writable)
+    ip->nwrite++;  // see exec()
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -351,6 +398,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+
+  return openpath(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -358,7 +417,7 @@ sys_mkdir(void)
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, DIRHASH, 0)) == 0){
     end_op();
     return -1;
   }
@@ -484,3 +543,118 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Map a submission/completion ring at URING, if the process
+// doesn't have one yet, and return its address.
+uint64
+sys_uringsetup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+
+  if(walkaddr(p->pagetable, URING))
+    return URING;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(p->pagetable, URING, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return URING;
+}
+
+// Carry out one queued request; returns its result.
+static int
+uringdo(struct uringsqe *sqe)
+{
+  char path[MAXPATH];
+  struct file *f = 0;
+
+  if(sqe->fd >= 0 && sqe->fd < NOFILE)
+    f = myproc()->ofile[sqe->fd];
+
+  switch(sqe->op){
+  case UR_READ:
+    if(f == 0 || sqe->n < 0)
+      return -1;
+    return fileread(f, sqe->addr, sqe->n);
+  case UR_WRITE:
+    if(f == 0 || sqe->n < 0)
+      return -1;
+    return filewrite(f, sqe->addr, sqe->n);
+  case UR_OPEN:
+    if(fetchstr(sqe->addr, path, MAXPATH) < 0)
+      return -1;
+    return openpath(path, sqe->n);
+  case UR_CLOSE:
+    return fdclose(sqe->fd);
+  }
+  return -1;
+}
+
+// Carry out the requests queued in the process's ring, in order,
+// posting a completion for each, for the cost of one trap.
+// Stops early if the completion queue fills.
+// Returns the number of requests consumed.
+uint64
+sys_uringenter(void)
+{
+  struct uring *r;
+  struct uringsqe sqe;
+  uint n = 0;
+
+  if((r = (struct uring*)walkaddr(myproc()->pagetable, URING)) == 0)
+    return -1;
+
+  // the ring is user memory; trust none of it.
+  while(r->sqhead != r->sqtail && r->sqtail - r->sqhead <= URING_NSQE){
+    if(r->cqtail - r->cqhead >= URING_NCQE)
+      break;
+    sqe = r->sq[r->sqhead % URING_NSQE];
+    r->sqhead++;
+    r->cq[r->cqtail % URING_NCQE].data = sqe.data;
+    r->cq[r->cqtail % URING_NCQE].res = uringdo(&sqe);
+    r->cqtail++;
+    n++;
+  }
+  return n;
+}
+
+// mmap(addr, len, prot, flags, fd, off) maps the open file fd.
+// addr is only a hint, which is ignored: the mapping goes at
+// the top of the process's memory.
+uint64
+sys_mmap(void)
+{
+  uint64 len;
+  int prot, flags, off, perm;
+  struct file *f;
+
+  if(argaddr(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(f->type != FD_INODE || f->readable == 0 || off < 0 || off % PGSIZE)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && f->writable == 0)
+    return -1;
+
+  perm = PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+  return vmamap(f->ip, len, perm, flags == MAP_SHARED, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return vmaunmap(addr, len);
+}
@@ -43,12 +43,20 @@ sys_sbrk(void)
 {
   int addr;
   int n;
+  struct proc *p = myproc();
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
+  addr = p->sz;
+  if(n < 0){
+    if(growproc(n) < 0)
+      return -1;
+  } else {
+    // allocate lazily: usertrap() maps each page on first touch.
+    if(p->sz + n >= URING)
+      return -1;
+    p->sz += n;
+  }
   return addr;
 }
 
@@ -56,21 +64,10 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return timersleep(n);
 }
 
 uint64
@@ -88,10 +85,27 @@ sys_kill(void)
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  return ticks;
+}
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+// copy each hart's idle time, in timer cycles, to the
+// array of n uint64s at the user address in arg 0.
+// returns the number of harts copied.
+uint64
+sys_idletime(void)
+{
+  uint64 addr, t[NCPU];
+  int n, i;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  if(n > NCPU)
+    n = NCPU;
+  if(n < 0)
+    return -1;
+  for(i = 0; i < n; i++)
+    t[i] = cpus[i].idletime;
+  if(copyout(myproc()->pagetable, addr, (char*)t, n*sizeof(uint64)) < 0)
+    return -1;
+  return n;
 }
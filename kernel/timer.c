@@ -0,0 +1,95 @@
+// Per-hart timers.
+//
+// Every hart takes its own timer interrupt each tick (see
+// timervec in kernelvec.S) and counts its own ticks; only
+// hart 0 advances the global ticks that uptime() returns.
+//
+// sleep() puts the caller on its hart's timer wheel, in the
+// slot for the tick at which it should wake, so that each tick
+// a hart wakes only the processes due then, instead of every
+// sleeper waking to look at the clock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NWHEEL 64  // slots per wheel
+
+struct wheel {
+  struct spinlock lock;
+  uint now;                  // ticks taken by this hart
+  struct proc *slot[NWHEEL]; // sleepers, by expire % NWHEEL
+} wheel[NCPU];
+
+void
+timerwheelinit(void)
+{
+  struct wheel *w;
+
+  for(w = wheel; w < &wheel[NCPU]; w++)
+    initlock(&w->lock, "wheel");
+}
+
+// Called on every hart's timer interrupt.
+// Wake the processes due at this tick.
+void
+timertick(void)
+{
+  struct wheel *w = &wheel[cpuid()];
+  struct proc **pp, *p;
+
+  acquire(&w->lock);
+  w->now++;
+  pp = &w->slot[w->now % NWHEEL];
+  while((p = *pp) != 0){
+    if((int)(p->expire - w->now) > 0){
+      // due on a later turn of the wheel.
+      pp = &p->tnext;
+      continue;
+    }
+    *pp = p->tnext;
+    p->timed = 0;
+    wakeup(&p->expire);
+  }
+  release(&w->lock);
+}
+
+// Sleep for n ticks of this hart's clock.
+// Returns 0, or -1 if killed first.
+int
+timersleep(int n)
+{
+  struct proc *p = myproc();
+  struct wheel *w;
+  struct proc **pp;
+
+  if(n <= 0)
+    return 0;
+
+  push_off();
+  w = &wheel[cpuid()];
+  pop_off();
+
+  acquire(&w->lock);
+  p->expire = w->now + n;
+  p->tnext = w->slot[p->expire % NWHEEL];
+  w->slot[p->expire % NWHEEL] = p;
+  p->timed = 1;
+  while(p->timed){
+    if(p->killed){
+      for(pp = &w->slot[p->expire % NWHEEL]; *pp != p; pp = &(*pp)->tnext)
+        ;
+      *pp = p->tnext;
+      p->timed = 0;
+      release(&w->lock);
+      return -1;
+    }
+    sleep(&p->expire, &w->lock);
+  }
+  release(&w->lock);
+  return 0;
+}
@@ -5,9 +5,12 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "vdso.h"
 
-struct spinlock tickslock;
-uint ticks;
+uint ticks;  // advanced only by hart 0
+struct vdso *vdso;  // mapped read-only at VDSO in every process
+
+extern uint64 timer_scratch[NCPU][7]; // start.c
 
 extern char trampoline[], uservec[], userret[];
 
@@ -19,7 +22,9 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("trapinit: vdso");
+  memset(vdso, 0, PGSIZE);
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -65,6 +70,20 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault on a lazily allocated, demand-paged,
+    // or copy-on-write page. reading a demand-paged page
+    // may wait for the disk, so, as for a system call, turn
+    // on interrupts, once done with the trap registers.
+    uint64 scause = r_scause(), stval = r_stval();
+
+    intr_on();
+
+    if(uvmfault(p, stval, scause == 15) != 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      p->killed = 1;
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -76,9 +95,9 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // maybe give up the CPU if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    schedtick();
 
   usertrapret();
 }
@@ -149,9 +168,9 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // maybe give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    schedtick();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -162,15 +181,14 @@ kerneltrap()
 void
 clockintr()
 {
-  acquire(&tickslock);
   ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
+  vdso->ticks = ticks;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
+// 3 if IPI,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -202,16 +220,22 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
+    // or an IPI from another hart's kick() in proc.c,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    // timervec sets scratch[6] for a timer interrupt.
+    if(__sync_lock_test_and_set(&timer_scratch[cpuid()][6], 0) == 0)
+      return 3;
+
+    if(cpuid() == 0){
+      clockintr();
+    }
+    timertick();
+
     return 2;
   } else {
     return 0;
@@ -0,0 +1,36 @@
+// A submission/completion ring, shared by a process and the
+// kernel at URING. The process fills in sq[sqtail % URING_NSQE]
+// and advances sqtail; uringenter() carries out the requests from
+// sqhead on, advancing it, and posts each result at
+// cq[cqtail % URING_NCQE]. The process reaps completions by
+// advancing cqhead. The indices only ever increase.
+
+#define URING_NSQE 64
+#define URING_NCQE 64
+
+#define UR_READ  1  // read(fd, addr, n)
+#define UR_WRITE 2  // write(fd, addr, n)
+#define UR_OPEN  3  // open(addr, n)
+#define UR_CLOSE 4  // close(fd)
+
+struct uringsqe {
+  int op;       // UR_READ, ...
+  int fd;
+  uint64 addr;  // buffer, or path for UR_OPEN
+  int n;        // byte count, or mode for UR_OPEN
+  uint64 data;  // copied to the completion
+};
+
+struct uringcqe {
+  uint64 data;  // the request's data
+  int res;      // what the system call would have returned
+};
+
+struct uring {
+  uint sqhead;
+  uint sqtail;
+  uint cqhead;
+  uint cqtail;
+  struct uringsqe sq[URING_NSQE];
+  struct uringcqe cq[URING_NCQE];
+};
@@ -0,0 +1,12 @@
+// Read-only pages through which user code can read some
+// kernel state without a system call.
+
+// At VDSO: one page, shared by every process.
+struct vdso {
+  uint ticks;   // clock ticks since boot, as uptime() returns
+};
+
+// At VDSOPROC: a page of each process's own.
+struct vdsoproc {
+  int pid;      // as getpid() returns
+};
@@ -5,6 +5,10 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "file.h"
 
 /*
  * the kernel's page table.
@@ -33,6 +37,9 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, for sending IPIs
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -160,7 +167,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never touched, and so
+// never mapped, are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -173,9 +181,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -293,8 +301,11 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: the parent and
+// child share the physical pages, and writable
+// pages become read-only and copy-on-write in both,
+// except those of shared mappings, which stay shared.
+// Heap pages not yet touched stay unmapped in both.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -303,22 +314,19 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
     pa = PTE2PA(*pte);
+    if((*pte & PTE_W) && (*pte & PTE_SHARED) == 0)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kref((void*)pa);
   }
   return 0;
 
@@ -340,6 +348,441 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Return the demand-paged region of p containing va, or 0.
+static struct vma*
+vmalookup(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Fill page mem, at va, from its demand-paged region v,
+// for a private copy of the file's page.
+// Reads through the buffer cache, so blocks of a program
+// that ran recently come from memory rather than the disk.
+// Returns 0 on success, -1 on a short read.
+static int
+vmaload(struct vma *v, uint64 va, char *mem)
+{
+  uint64 off = va - v->start;
+  uint n;
+
+  if(off >= v->filesz)
+    return 0;
+  n = v->filesz - off;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  ilock(v->ip);
+  if(readi(v->ip, 0, (uint64)mem, v->off + off, n) != n){
+    iunlock(v->ip);
+    return -1;
+  }
+  iunlock(v->ip);
+  return 0;
+}
+
+// Handle a page fault at user virtual address va in process p.
+// write is set for a store fault.
+// A page of a demand-paged region, such as an ELF segment set
+// up by exec() or a file mapped by mmap(), is read in from its
+// file on first touch. A shared mapping maps the file's page in
+// the page cache itself, so that every process mapping the file
+// sees the same page, read-only until the first store to it,
+// which marks it dirty.
+// sbrk() only grows p->sz, so the first touch of any other page
+// below p->sz maps a zeroed page. If the page is copy-on-write,
+// give p its own writable copy, or the page itself if no one
+// else shares it any more.
+// Returns 0 if the fault was handled, -1 if the access is bad.
+int
+uvmfault(struct proc *p, uint64 va, int write)
+{
+  pagetable_t pagetable = p->pagetable;
+  struct vma *v;
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+  int locked, perm;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(va >= p->sz)
+      return -1;
+    v = vmalookup(p, va);
+    perm = PTE_W|PTE_X|PTE_R;
+    if(v){
+      perm = v->perm;
+      if(write && (perm & PTE_W) == 0)
+        return -1;
+      if(v->shared){
+        perm |= PTE_SHARED;
+        if(write)
+          perm |= PTE_D;
+        else
+          perm &= ~PTE_W;
+      }
+    }
+    if(v && (v->shared || va - v->start < v->filesz)){
+      // reading the file may sleep, which a caller
+      // holding a spinlock can't; see uvmprefault().
+      push_off();
+      locked = mycpu()->noff > 1;
+      pop_off();
+      if(locked)
+        return -1;
+    }
+    if(v && v->shared){
+      ilock(v->ip);
+      mem = pmap(v->ip, (v->off + (va - v->start)) / PGSIZE);
+      iunlock(v->ip);
+      if(mem == 0)
+        return -1;
+      if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm|PTE_U) != 0){
+        kfree(mem);
+        return -1;
+      }
+      return 0;
+    }
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(v && vmaload(v, va, mem) != 0){
+      kfree(mem);
+      return -1;
+    }
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm|PTE_U) != 0){
+      kfree(mem);
+      return -1;
+    }
+    return 0;
+  }
+  if((*pte & PTE_U) == 0)
+    return -1;
+  if(write && (*pte & PTE_SHARED) && (*pte & PTE_W) == 0){
+    // first store to a clean page of a shared mapping.
+    if((v = vmalookup(p, va)) == 0 || (v->perm & PTE_W) == 0)
+      return -1;
+    *pte |= PTE_W | PTE_D;
+    return 0;
+  }
+  if(!write || (*pte & PTE_COW) == 0)
+    return -1;
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Share p's page at va with the kernel, for vmsplice(): fault
+// the page in if need be, make it copy-on-write so that p's later
+// stores don't change the kernel's view, and take a reference.
+// Returns the page's physical address, or 0.
+uint64
+uvmcowpage(struct proc *p, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(va >= p->sz || va % PGSIZE)
+    return 0;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(uvmfault(p, va, 0) != 0)
+      return 0;
+    pte = walk(p->pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0 || (*pte & PTE_SHARED))
+    return 0;
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  pa = PTE2PA(*pte);
+  kref((void*)pa);
+  return pa;
+}
+
+// Map page pa at va in p in place of what is there, for
+// vmsplice(). The mapping takes over the caller's reference to
+// pa, and is copy-on-write if anyone else still holds one.
+// va must be a writable page below p->sz.
+// Returns 0 on success, -1 if va can't be replaced.
+int
+uvmremap(struct proc *p, uint64 va, uint64 pa)
+{
+  pte_t *pte;
+  uint flags = PTE_W|PTE_X|PTE_R|PTE_U;
+
+  if(va >= p->sz || va % PGSIZE)
+    return -1;
+  if((pte = walk(p->pagetable, va, 1)) == 0)
+    return -1;
+  if(*pte & PTE_V){
+    if((*pte & PTE_U) == 0 || (*pte & (PTE_W|PTE_COW)) == 0 || (*pte & PTE_SHARED))
+      return -1;
+    flags = (PTE_FLAGS(*pte) & ~(PTE_COW|PTE_V)) | PTE_W;
+    kfree((void*)PTE2PA(*pte));
+  }
+  if(krefcnt((void*)pa) > 1)
+    flags = (flags & ~PTE_W) | PTE_COW;
+  *pte = PA2PTE(pa) | flags | PTE_V;
+  return 0;
+}
+
+// Read in the current process's demand-paged pages that overlap
+// [va, va+len), for a caller that is about to copyin() or copyout()
+// that range while holding a lock: a spinlock, under which reading
+// the file can't sleep, or an inode lock, which the read might need.
+// Bad addresses are left for the copy to reject.
+void
+uvmprefault(uint64 va, uint64 len, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, end;
+  pte_t *pte;
+
+  if(va + len < va)
+    return;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip == 0)
+      continue;
+    a = PGROUNDDOWN(va) < v->start ? v->start : PGROUNDDOWN(va);
+    end = va + len < v->end ? va + len : v->end;
+    for(; a < end && a < p->sz; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        uvmfault(p, a, write);
+    }
+  }
+}
+
+// Add n to the count of v's kind of user in v's file:
+// ip->ntext for a program's segment, ip->nwrite for a shared
+// writable mapping. While a file has text users it can't be
+// written, and while it has writers it can't be run, so the
+// pages of a running program always read in what exec() saw.
+// Caller must hold v->ip->lock.
+void
+vmacount(struct vma *v, int n)
+{
+  if(v->text)
+    v->ip->ntext += n;
+  else if(v->shared && (v->perm & PTE_W))
+    v->ip->nwrite += n;
+}
+
+// Take another reference to v's file, for a copy of v.
+void
+vmadup(struct vma *v)
+{
+  idup(v->ip);
+  ilock(v->ip);
+  vmacount(v, 1);
+  iunlock(v->ip);
+}
+
+// Drop v's reference to its file.
+// Caller must be in a file system transaction, since iput() may
+// free an unlinked file.
+static void
+vmadrop(struct vma *v)
+{
+  ilock(v->ip);
+  vmacount(v, -1);
+  iunlock(v->ip);
+  iput(v->ip);
+  v->ip = 0;
+}
+
+// Drop the file references of the regions in vma[NVMA].
+// Caller must be in a file system transaction.
+void
+vmaput(struct vma *vma)
+{
+  for(int i = 0; i < NVMA; i++){
+    if(vma[i].ip)
+      vmadrop(&vma[i]);
+  }
+}
+
+// Write the dirty pages of shared mapping v in [start, end)
+// back to its file, and map them read-only again. Only the
+// bytes within the file's current size go back, so that stores
+// past the end don't extend a file truncated since mmap().
+// Returns 0, or -1 if a write failed, leaving its page dirty.
+// Caller must not be in a file system transaction.
+int
+vmawriteback(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  pte_t *pte;
+  uint64 a;
+  uint off, n;
+  int r = 0;
+
+  for(a = start; a < end; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    off = v->off + (a - v->start);
+    begin_op();
+    ilock(v->ip);
+    n = off < v->ip->size ? v->ip->size - off : 0;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if(n > 0 && writei(v->ip, 0, PTE2PA(*pte), off, n) != n)
+      r = -1;
+    else
+      *pte &= ~(PTE_W|PTE_D);
+    iunlock(v->ip);
+    end_op();
+  }
+  return r;
+}
+
+// Write back the shared mappings among the regions in vma[NVMA].
+// Returns 0, or -1 if a write failed.
+// Caller must not be in a file system transaction.
+int
+vmasync(pagetable_t pagetable, struct vma *vma)
+{
+  int r = 0;
+
+  for(int i = 0; i < NVMA; i++)
+    if(vma[i].ip && vma[i].shared &&
+       vmawriteback(pagetable, &vma[i], vma[i].start, vma[i].end) != 0)
+      r = -1;
+  return r;
+}
+
+// Map len bytes of ip, from offset off, at the top of the
+// current process's memory, for mmap(). perm holds the pages'
+// PTE_R, PTE_W and PTE_X; if shared is set, stores go back to
+// the file. Pages are read in on first touch.
+// Returns the address, or -1.
+uint64
+vmamap(struct inode *ip, uint64 len, int perm, int shared, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 addr = PGROUNDUP(p->sz);
+  uint size;
+
+  if(len == 0 || addr + len < addr || addr + PGROUNDUP(len) >= URING)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip == 0)
+      break;
+  if(v == &p->vma[NVMA])
+    return -1;
+
+  ilock(ip);
+  if(shared && (perm & PTE_W) && ip->ntext > 0){
+    // a running program can't be written.
+    iunlock(ip);
+    return -1;
+  }
+  size = ip->size;
+  v->start = addr;
+  v->end = addr + PGROUNDUP(len);
+  v->ip = idup(ip);
+  v->off = off;
+  v->filesz = off < size ? size - off : 0;
+  if(v->filesz > len)
+    v->filesz = len;
+  v->perm = perm;
+  v->shared = shared;
+  v->text = 0;
+  vmacount(v, 1);
+  iunlock(ip);
+  p->sz = v->end;
+  return addr;
+}
+
+// Unmap [addr, addr+len) of the current process, for munmap().
+// The range must be all of a mapped region, or its start or
+// end; dirty pages of a shared mapping go back to the file.
+// Addresses left below p->sz act as untouched heap afterwards.
+// Returns 0, or -1 if no region fits or a write back fails, in
+// which case the range stays mapped.
+int
+vmaunmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end = addr + PGROUNDUP(len);
+
+  if(addr % PGSIZE || len == 0 || end < addr)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->ip && addr >= v->start && end <= v->end)
+      break;
+  if(v == &p->vma[NVMA] || (addr != v->start && end != v->end))
+    return -1;
+
+  if(v->shared && vmawriteback(p->pagetable, v, addr, end) != 0)
+    return -1;
+  uvmunmap(p->pagetable, addr, (end - addr) / PGSIZE, 1);
+  if(addr == v->start && end == v->end){
+    begin_op();
+    vmadrop(v);
+    end_op();
+  } else if(addr == v->start){
+    v->filesz = v->filesz > end - addr ? v->filesz - (end - addr) : 0;
+    v->off += end - addr;
+    v->start = end;
+  } else {
+    if(v->filesz > addr - v->start)
+      v->filesz = addr - v->start;
+    v->end = addr;
+  }
+  if(end >= p->sz)
+    p->sz = addr;
+  return 0;
+}
+
+// Like walkaddr(), but if pagetable is the current process's,
+// first take the fault that a user access to va would: map a
+// lazily allocated or demand-paged page, or, if write is set,
+// copy a copy-on-write page or dirty a shared one. A write to
+// a page that is still read-only, such as the VDSO pages every
+// process maps, is refused in any page table.
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(p && p->pagetable == pagetable){
+    if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0)){
+      if(uvmfault(p, va, write) != 0)
+        return 0;
+      pte = walk(pagetable, va, 0);
+    }
+  }
+  if(write && (pte == 0 || (*pte & PTE_W) == 0))
+    return 0;
+  return walkaddr(pagetable, va);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -350,7 +793,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -375,7 +818,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -402,7 +845,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
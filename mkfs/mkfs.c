@@ -20,9 +20,10 @@
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
+int fssize = FSSIZE; // Size of file system in blocks (-s)
+int nbitmap;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE + 1;  // Header plus log data blocks (-l)
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,7 +41,9 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirlink(uint dirino, char *name, uint inum);
 void die(const char *);
+void usage(void);
 
 // convert to intel byte order
 ushort
@@ -68,33 +71,49 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  int i, cc, fd, first;
+  uint rootino, inum;
   char buf[BSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  for(first = 1; first + 1 < argc && argv[first][0] == '-'; first += 2){
+    if(strcmp(argv[first], "-s") == 0)
+      fssize = atoi(argv[first+1]);
+    else if(strcmp(argv[first], "-l") == 0)
+      nlog = atoi(argv[first+1]);
+    else
+      usage();
+  }
+  if(first >= argc || argv[first][0] == '-')
+    usage();
+  // the kernel needs room for at least one FS system call,
+  // and one header block can name only LOGSIZE blocks.
+  if(nlog < MAXOPBLOCKS + 1 || nlog > LOGSIZE + 1){
+    fprintf(stderr, "mkfs: log size must be %d..%d\n", MAXOPBLOCKS + 1, LOGSIZE + 1);
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
-  fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
+  fsfd = open(argv[first], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0)
-    die(argv[1]);
+    die(argv[first]);
 
   // 1 fs block = 1 disk sector
+  nbitmap = fssize/(BSIZE*8) + 1;
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  if(fssize <= nmeta){
+    fprintf(stderr, "mkfs: file system size %d too small\n", fssize);
+    exit(1);
+  }
+  nblocks = fssize - nmeta;
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
@@ -103,11 +122,11 @@ main(int argc, char *argv[])
   sb.bmapstart = xint(2+nlog+ninodeblocks);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < fssize; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -116,18 +135,14 @@ main(int argc, char *argv[])
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
+  rinode(rootino, &din);
+  din.major = xshort(DIRHASH);
+  winode(rootino, &din);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  dirlink(rootino, ".", rootino);
+  dirlink(rootino, "..", rootino);
 
-  for(i = 2; i < argc; i++){
+  for(i = first + 1; i < argc; i++){
     // get rid of "user/"
     char *shortname;
     if(strncmp(argv[i], "user/", 5) == 0)
@@ -148,11 +163,7 @@ main(int argc, char *argv[])
       shortname += 1;
 
     inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirlink(rootino, shortname, inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,13 +171,6 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
-
   balloc(freeblock);
 
   exit(0);
@@ -249,6 +253,52 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry n of indirect block addr,
+// allocating a block for it if necessary.
+uint
+indirectblock(uint addr, uint n)
+{
+  uint indirect[NINDIRECT];
+
+  rsect(addr, (char*)indirect);
+  if(indirect[n] == 0){
+    indirect[n] = xint(freeblock++);
+    wsect(addr, (char*)indirect);
+  }
+  return xint(indirect[n]);
+}
+
+// Return the address of block fbn of din,
+// allocating a block for it if necessary.
+// Blocks are handed out in order, so each file's blocks
+// follow one another, with an indirect block just before
+// the blocks it lists, as the kernel's balloc() places them.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint x;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(freeblock++);
+    }
+    return xint(din->addrs[fbn]);
+  } else if(fbn < NDIRECT + NINDIRECT){
+    if(xint(din->addrs[NDIRECT]) == 0){
+      din->addrs[NDIRECT] = xint(freeblock++);
+    }
+    return indirectblock(xint(din->addrs[NDIRECT]), fbn - NDIRECT);
+  } else {
+    if(xint(din->addrs[NDIRECT+1]) == 0){
+      din->addrs[NDIRECT+1] = xint(freeblock++);
+    }
+    x = fbn - NDIRECT - NINDIRECT;
+    return indirectblock(indirectblock(xint(din->addrs[NDIRECT+1]), x / NINDIRECT),
+                         x % NINDIRECT);
+  }
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +306,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -264,23 +313,7 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -293,9 +326,49 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Put entry (name, inum) in hashed directory dirino, in the
+// first level whose block for name has room, as the kernel's
+// dirlink() does. The directory's size covers the whole level.
+void
+dirlink(uint dirino, char *name, uint inum)
+{
+  struct dinode din;
+  struct dirent de[DPB];
+  uint h, k, bn, end;
+  int i;
+
+  rinode(dirino, &din);
+  h = dirhash(name);
+  for(k = 0; ; k++){
+    bn = DIRBLOCK(h, k);
+    end = (1U << (k+1)) - 1;
+    assert(end <= MAXFILE);
+    rsect(bmap(&din, bn), (char*)de);
+    for(i = 0; i < DPB; i++)
+      if(de[i].inum == 0)
+        break;
+    if(i < DPB)
+      break;
+  }
+  bzero(&de[i], sizeof(de[i]));
+  de[i].inum = xshort(inum);
+  strncpy(de[i].name, name, DIRSIZ);
+  wsect(bmap(&din, bn), (char*)de);
+  if(xint(din.size) < end * BSIZE)
+    din.size = xint(end * BSIZE);
+  winode(dirino, &din);
+}
+
 void
 die(const char *s)
 {
   perror(s);
   exit(1);
 }
+
+void
+usage(void)
+{
+  fprintf(stderr, "Usage: mkfs [-s fssize] [-l nlog] fs.img files...\n");
+  exit(1);
+}
@@ -0,0 +1,90 @@
+//
+// grow several files a block at a time, taking turns, so that
+// each one's allocations must skip the others' blocks; check
+// the contents, remove the files, and do it again, so that
+// freed blocks are allocated again.
+//
+// usage: balloctest [blocks]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NF 3
+#define ROUNDS 4
+
+char buf[1024];
+
+void
+fail(char *what, int i)
+{
+  fprintf(2, "balloctest: %s %d failed\n", what, i);
+  exit(1);
+}
+
+void
+fill(int f, int b)
+{
+  int i;
+
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = f * 31 + b * 7 + i;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 300, fd[NF], f, b, i, r, start;
+  char name[] = "ba.?";
+  char want[sizeof(buf)];
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: balloctest [blocks]\n");
+    exit(1);
+  }
+
+  for(r = 0; r < ROUNDS; r++){
+    start = uptime();
+    for(f = 0; f < NF; f++){
+      name[3] = '0' + f;
+      if((fd[f] = open(name, O_CREATE|O_TRUNC|O_WRONLY)) < 0)
+        fail("create", f);
+    }
+    for(b = 0; b < n; b++){
+      for(f = 0; f < NF; f++){
+        fill(f, b);
+        if(write(fd[f], buf, sizeof(buf)) != sizeof(buf))
+          fail("write", b);
+      }
+    }
+    for(f = 0; f < NF; f++)
+      close(fd[f]);
+    printf("round %d: %d blocks in %d files: %d ticks\n",
+           r, n * NF, NF, uptime() - start);
+
+    for(f = 0; f < NF; f++){
+      name[3] = '0' + f;
+      if((fd[f] = open(name, O_RDONLY)) < 0)
+        fail("open", f);
+      for(b = 0; b < n; b++){
+        fill(f, b);
+        memmove(want, buf, sizeof(buf));
+        if(read(fd[f], buf, sizeof(buf)) != sizeof(buf))
+          fail("read", b);
+        for(i = 0; i < sizeof(buf); i++)
+          if(buf[i] != want[i])
+            fail("contents", b);
+      }
+      close(fd[f]);
+      if(unlink(name) < 0)
+        fail("unlink", f);
+    }
+  }
+
+  printf("balloctest: OK\n");
+  exit(0);
+}
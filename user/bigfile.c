@@ -0,0 +1,76 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+
+// Write a file of the given number of blocks, by default enough
+// to need the double-indirect block, then read it back. A file
+// of MAXFILE blocks needs a bigger disk than the default one;
+// see MKFSFLAGS in the Makefile. For MAXFILE blocks, check too
+// that the file can't grow any further.
+//
+// usage: bigfile [blocks]
+int
+main(int argc, char *argv[])
+{
+  char buf[BSIZE];
+  int fd, i, n, blocks;
+
+  n = NDIRECT + NINDIRECT + 2*NINDIRECT;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > MAXFILE){
+    printf("usage: bigfile [blocks], at most %d\n", MAXFILE);
+    exit(1);
+  }
+
+  fd = open("big.file", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("bigfile: cannot open big.file for writing\n");
+    exit(1);
+  }
+
+  for(blocks = 0; blocks < n; blocks++){
+    *(int*)buf = blocks;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      break;
+    if (blocks % 100 == 0)
+      printf(".");
+  }
+
+  printf("\nwrote %d blocks\n", blocks);
+  if(blocks != n) {
+    printf("bigfile: file is too small\n");
+    exit(1);
+  }
+  if(n == MAXFILE && write(fd, buf, sizeof(buf)) > 0){
+    printf("bigfile: file grew past MAXFILE\n");
+    exit(1);
+  }
+
+  close(fd);
+  fd = open("big.file", O_RDONLY);
+  if(fd < 0){
+    printf("bigfile: cannot re-open big.file for reading\n");
+    exit(1);
+  }
+  for(i = 0; i < blocks; i++){
+    int cc = read(fd, buf, sizeof(buf));
+    if(cc <= 0){
+      printf("bigfile: read error at block %d\n", i);
+      exit(1);
+    }
+    if(*(int*)buf != i){
+      printf("bigfile: read the wrong data (%d) for block %d\n",
+             *(int*)buf, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("big.file");
+
+  printf("bigfile done; ok\n");
+
+  exit(0);
+}
@@ -0,0 +1,103 @@
+//
+// time adding, looking up, and removing many names in one
+// directory. The names are links to one file, so that they
+// don't use up inodes.
+//
+// usage: dirbench [names]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char file[] = "db.file";
+
+void
+fail(char *what, int i)
+{
+  fprintf(2, "dirbench: %s %d failed\n", what, i);
+  exit(1);
+}
+
+// set path to the name of the ith link.
+void
+name(char *path, int i)
+{
+  char *p;
+  int j;
+
+  strcpy(path, "db.d/n");
+  p = path + strlen(path);
+  for(j = 0; j < 5; j++){
+    *p++ = 'a' + i % 26;
+    i /= 26;
+  }
+  *p = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 1000, i, fd, start;
+  char path[32];
+  struct stat st;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: dirbench [names]\n");
+    exit(1);
+  }
+
+  if(mkdir("db.d") < 0)
+    fail("mkdir", 0);
+  if((fd = open(file, O_CREATE|O_RDWR)) < 0)
+    fail("create", 0);
+  close(fd);
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    name(path, i);
+    if(link(file, path) < 0)
+      fail("link", i);
+  }
+  printf("%d links: %d ticks\n", n, uptime() - start);
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    name(path, i);
+    if(stat(path, &st) < 0 || st.nlink != n + 1)
+      fail("stat", i);
+  }
+  printf("%d lookups: %d ticks\n", n, uptime() - start);
+
+  if(stat("db.d", &st) < 0)
+    fail("stat db.d", 0);
+  printf("directory size %d\n", st.size);
+
+  // a name that was never linked, and a removed one,
+  // must not be found.
+  name(path, n);
+  if(stat(path, &st) == 0)
+    fail("stat missing", n);
+  if(unlink("db.d") == 0)
+    fail("unlink non-empty", 0);
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    name(path, i);
+    if(unlink(path) < 0)
+      fail("unlink", i);
+    if(stat(path, &st) == 0)
+      fail("stat removed", i);
+  }
+  printf("%d unlinks: %d ticks\n", n, uptime() - start);
+
+  if(unlink("db.d") < 0)
+    fail("unlink db.d", 0);
+  if(unlink(file) < 0)
+    fail("unlink", 0);
+  printf("dirbench: OK\n");
+  exit(0);
+}
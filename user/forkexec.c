@@ -0,0 +1,193 @@
+//
+// fork() benchmark: time fork+exit and fork+exec+exit with a
+// parent whose heap is NPAGE pages, and check that parent and
+// child see their own copies of memory after a fork. Also check
+// that a running program can't be written and a file open for
+// writing can't be run.
+//
+// usage: forkexec [npage]
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NFORK  100   // fork rounds per measurement
+
+char *heap;
+int npage = 1024;
+
+// fork children that exit at once.
+int
+forkloop(void)
+{
+  int i, pid, t0;
+
+  t0 = uptime();
+  for(i = 0; i < NFORK; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("forkexec: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  return uptime() - t0;
+}
+
+// fork children that exec a program that exits at once.
+int
+execloop(void)
+{
+  int i, pid, t0;
+  char *argv[] = { "forkexec", "-exit", 0 };
+
+  t0 = uptime();
+  for(i = 0; i < NFORK; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("forkexec: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec("forkexec", argv);
+      printf("forkexec: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  return uptime() - t0;
+}
+
+// the child writes every page, and the parent must not see it.
+void
+sharetest(void)
+{
+  int i, pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("forkexec: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < npage; i++){
+      if(heap[i*PGSIZE] != (char)i){
+        printf("forkexec: child sees wrong data\n");
+        exit(1);
+      }
+      heap[i*PGSIZE] = -1;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  for(i = 0; i < npage; i++){
+    if(heap[i*PGSIZE] != (char)i){
+      printf("forkexec: parent sees child's write\n");
+      exit(1);
+    }
+  }
+}
+
+// fork a child to run "file -exit", and return its exit status,
+// or -1 if exec() fails.
+int
+runexit(char *file)
+{
+  char *argv[] = { file, "-exit", 0 };
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("forkexec: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(file, argv);
+    exit(-1);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+// the program's pages are read in as it runs, so it must
+// not change meanwhile.
+void
+texttest(void)
+{
+  char *copy = "forkexec.tmp", buf[512];
+  int fd, in, n;
+
+  if(open("forkexec", O_WRONLY) >= 0 || open("forkexec", O_RDWR) >= 0 ||
+     open("forkexec", O_RDONLY|O_TRUNC) >= 0){
+    printf("forkexec: opened running program for writing\n");
+    exit(1);
+  }
+  if((fd = open("forkexec", O_RDONLY)) < 0){
+    printf("forkexec: open for reading failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  // a copy can't run while it is open for writing.
+  if((in = open("forkexec", O_RDONLY)) < 0 ||
+     (fd = open(copy, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("forkexec: open failed\n");
+    exit(1);
+  }
+  while((n = read(in, buf, sizeof(buf))) > 0){
+    if(write(fd, buf, n) != n){
+      printf("forkexec: write failed\n");
+      exit(1);
+    }
+  }
+  close(in);
+  if(runexit(copy) != -1){
+    printf("forkexec: ran a program open for writing\n");
+    exit(1);
+  }
+  close(fd);
+  if(runexit(copy) != 0){
+    printf("forkexec: exec of copy failed\n");
+    exit(1);
+  }
+  unlink(copy);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit(0);
+  if(argc > 1)
+    npage = atoi(argv[1]);
+  if(npage < 1){
+    fprintf(2, "usage: forkexec [npage]\n");
+    exit(1);
+  }
+
+  heap = sbrk(npage*PGSIZE);
+  if(heap == (char*)-1){
+    printf("forkexec: sbrk failed\n");
+    exit(1);
+  }
+  for(i = 0; i < npage; i++)
+    heap[i*PGSIZE] = i;
+
+  sharetest();
+  texttest();
+  printf("forkexec: %d fork+exit, %d pages: %d ticks\n", NFORK, npage, forkloop());
+  printf("forkexec: %d fork+exec, %d pages: %d ticks\n", NFORK, npage, execloop());
+  sharetest();
+  printf("forkexec: OK\n");
+  exit(0);
+}
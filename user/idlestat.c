@@ -0,0 +1,46 @@
+//
+// print how idle each hart was over an interval.
+//
+// usage: idlestat [ticks]
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define CYCLES_PER_TICK 1000000  // timerinit()'s interval
+
+int
+main(int argc, char *argv[])
+{
+  uint64 t0[NCPU], t1[NCPU];
+  int n, i, ticks = 10, start, elapsed;
+
+  if(argc > 1)
+    ticks = atoi(argv[1]);
+  if(ticks < 1){
+    fprintf(2, "usage: idlestat [ticks]\n");
+    exit(1);
+  }
+
+  start = uptime();
+  n = idletime(t0, NCPU);
+  sleep(ticks);
+  if(idletime(t1, NCPU) != n || n < 0){
+    fprintf(2, "idlestat: idletime failed\n");
+    exit(1);
+  }
+  elapsed = uptime() - start;
+  if(elapsed < 1)
+    elapsed = 1;
+
+  // harts that never started never idle; skip them.
+  for(i = 0; i < n; i++){
+    if(t1[i] == 0)
+      continue;
+    printf("hart %d: %d%% idle\n", i,
+           (int)((t1[i] - t0[i]) * 100 / ((uint64)elapsed * CYCLES_PER_TICK)));
+  }
+  exit(0);
+}
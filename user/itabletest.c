@@ -0,0 +1,132 @@
+//
+// time stat() of every file in / with the inode table cold and
+// warm, and check that processes creating, opening, and removing
+// files at once each see their own inodes.
+//
+// usage: itabletest [passes]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define NFILE 10
+
+void
+fail(char *what)
+{
+  fprintf(2, "itabletest: %s failed\n", what);
+  exit(1);
+}
+
+// stat every entry in /, n times over, and return the ticks it took.
+int
+statall(int n)
+{
+  char path[DIRSIZ+2];
+  struct dirent de;
+  struct stat st;
+  int fd, start = uptime();
+
+  while(n-- > 0){
+    if((fd = open("/", O_RDONLY)) < 0)
+      fail("open /");
+    while(read(fd, &de, sizeof(de)) == sizeof(de)){
+      if(de.inum == 0)
+        continue;
+      path[0] = '/';
+      memmove(path+1, de.name, DIRSIZ);
+      path[DIRSIZ+1] = 0;
+      if(stat(path, &st) < 0 || st.ino != de.inum)
+        fail("stat");
+    }
+    close(fd);
+  }
+  return uptime() - start;
+}
+
+// in directory it<c>.d, create, check, and remove
+// files named it<c>.<i>, each holding its own name.
+void
+churn(int c, int passes)
+{
+  char name[8], got[8];
+  int fd, i, p;
+
+  strcpy(name, "it?.d");
+  name[2] = '0' + c;
+  if(chdir(name) < 0)
+    fail("chdir");
+  for(p = 0; p < passes; p++){
+    for(i = 0; i < NFILE; i++){
+      name[4] = '0' + i;
+      if((fd = open(name, O_CREATE|O_WRONLY)) < 0)
+        fail("create");
+      if(write(fd, name, sizeof(name)) != sizeof(name))
+        fail("write");
+      close(fd);
+    }
+    for(i = 0; i < NFILE; i++){
+      name[4] = '0' + i;
+      if((fd = open(name, O_RDONLY)) < 0)
+        fail("open");
+      if(read(fd, got, sizeof(got)) != sizeof(got) || strcmp(got, name) != 0)
+        fail("contents");
+      close(fd);
+      if(unlink(name) < 0)
+        fail("unlink");
+    }
+    statall(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int passes = 20, c, xstatus;
+  char dir[8];
+
+  if(argc > 1)
+    passes = atoi(argv[1]);
+  if(passes < 1){
+    fprintf(2, "usage: itabletest [passes]\n");
+    exit(1);
+  }
+
+  printf("first stat of /: %d ticks\n", statall(1));
+  printf("%d more: %d ticks\n", passes, statall(passes));
+
+  // the children work in their own directories,
+  // so that the entries of / stay put for statall().
+  strcpy(dir, "it?.d");
+  for(c = 0; c < NCHILD; c++){
+    dir[2] = '0' + c;
+    if(mkdir(dir) < 0)
+      fail("mkdir");
+  }
+  for(c = 0; c < NCHILD; c++){
+    int pid = fork();
+    if(pid < 0)
+      fail("fork");
+    if(pid == 0){
+      churn(c, passes);
+      exit(0);
+    }
+  }
+  for(c = 0; c < NCHILD; c++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      fail("child");
+  }
+  for(c = 0; c < NCHILD; c++){
+    dir[2] = '0' + c;
+    if(unlink(dir) < 0)
+      fail("unlink dir");
+  }
+
+  printf("itabletest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,106 @@
+//
+// kalloc() benchmark: several processes allocate and free
+// pages in parallel, so that on a multi-hart machine the
+// cost of contention on the page allocator's locks shows up
+// as elapsed ticks.
+//
+// usage: kalloctest [nproc]
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NROUND  200   // sbrk grow/shrink rounds per process
+#define NPAGE    64   // pages allocated per round
+#define NFORK   100   // fork/exit rounds per process
+
+// grow the heap by NPAGE pages, touch them so that they are
+// really allocated, and give them back. repeat.
+void
+sbrkloop(void)
+{
+  char *a;
+  int i, j;
+
+  for(i = 0; i < NROUND; i++){
+    a = sbrk(NPAGE*PGSIZE);
+    if(a == (char*)-1){
+      printf("kalloctest: sbrk failed\n");
+      exit(1);
+    }
+    for(j = 0; j < NPAGE; j++)
+      a[j*PGSIZE] = j;
+    if(sbrk(-NPAGE*PGSIZE) == (char*)-1){
+      printf("kalloctest: sbrk shrink failed\n");
+      exit(1);
+    }
+  }
+}
+
+// fork children that exit at once; each fork allocates and
+// frees a page table, trapframe and a copy of the user memory.
+void
+forkloop(void)
+{
+  int i, pid;
+
+  for(i = 0; i < NFORK; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("kalloctest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+}
+
+// run fn in nproc processes at once; return elapsed ticks.
+int
+run(int nproc, void (*fn)(void))
+{
+  int i, pid, xstatus, t0;
+
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("kalloctest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      fn();
+      exit(0);
+    }
+  }
+  for(i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 4;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > NCPU){
+    fprintf(2, "usage: kalloctest [nproc], 1 <= nproc <= %d\n", NCPU);
+    exit(1);
+  }
+
+  printf("kalloctest: sbrk, 1 process: %d ticks\n", run(1, sbrkloop));
+  printf("kalloctest: sbrk, %d processes: %d ticks\n", nproc, run(nproc, sbrkloop));
+  printf("kalloctest: fork, 1 process: %d ticks\n", run(1, forkloop));
+  printf("kalloctest: fork, %d processes: %d ticks\n", nproc, run(nproc, forkloop));
+  printf("kalloctest: OK\n");
+  exit(0);
+}
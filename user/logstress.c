@@ -0,0 +1,83 @@
+// Measure file system throughput with many small writers.
+// Each child creates its own file and writes it in small
+// pieces, so every write() is a separate log transaction,
+// and the writers' transactions are grouped into commits.
+//
+// usage: logstress [nchild]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define NWRITE 200   // writes per child
+#define WSIZE   64   // bytes per write
+
+void
+writer(int i)
+{
+  char path[] = "logstress0";
+  char data[WSIZE];
+  int fd, n;
+
+  path[9] += i;
+  memset(data, 'a' + i, sizeof(data));
+  fd = open(path, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("logstress: open %s failed\n", path);
+    exit(1);
+  }
+  for(n = 0; n < NWRITE; n++){
+    if(write(fd, data, sizeof(data)) != sizeof(data)){
+      printf("logstress: write %s failed\n", path);
+      exit(1);
+    }
+  }
+  close(fd);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, nchild = 4, xstatus, t;
+  char path[] = "logstress0";
+
+  if(argc > 1)
+    nchild = atoi(argv[1]);
+  if(nchild < 1 || nchild > 10){
+    fprintf(2, "usage: logstress [nchild], 1 <= nchild <= 10\n");
+    exit(1);
+  }
+
+  printf("logstress: %d writers, %d writes of %d bytes each\n",
+         nchild, NWRITE, WSIZE);
+  t = uptime();
+  for(i = 0; i < nchild; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("logstress: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      writer(i);
+  }
+  for(i = 0; i < nchild; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  t = uptime() - t;
+
+  printf("logstress: %d writes in %d ticks\n", nchild * NWRITE, t);
+  if(t > 0)
+    printf("logstress: %d writes per tick\n", nchild * NWRITE / t);
+
+  for(i = 0; i < nchild; i++){
+    path[9] = '0' + i;
+    unlink(path);
+  }
+  printf("logstress: OK\n");
+  exit(0);
+}
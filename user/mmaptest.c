@@ -0,0 +1,211 @@
+//
+// test mmap() and munmap() of files.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGE 3
+#define SZ (NPAGE*PGSIZE + 100)  // ends partway through a page
+
+char *file = "mmaptest.tmp";
+
+void
+fail(char *what)
+{
+  fprintf(2, "mmaptest: %s failed\n", what);
+  unlink(file);
+  exit(1);
+}
+
+// create the file, with byte i holding i % 251.
+void
+makefile(void)
+{
+  static char buf[SZ];
+  int fd, i;
+
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 251;
+  if((fd = open(file, O_CREATE|O_RDWR|O_TRUNC)) < 0)
+    fail("create");
+  if(write(fd, buf, SZ) != SZ)
+    fail("write");
+  close(fd);
+}
+
+// check that the file's byte i is i % 251, except that
+// byte 0 of each page is page+'A' if changed is set.
+void
+checkfile(int changed)
+{
+  static char buf[SZ];
+  int fd, i;
+  char want;
+
+  if((fd = open(file, O_RDONLY)) < 0)
+    fail("open");
+  if(read(fd, buf, SZ) != SZ)
+    fail("read");
+  close(fd);
+  for(i = 0; i < SZ; i++){
+    want = (changed && i % PGSIZE == 0) ? i / PGSIZE + 'A' : i % 251;
+    if(buf[i] != want)
+      fail(changed ? "shared write-back" : "file unchanged");
+  }
+}
+
+// check a mapping of the file, including the zeroes past its end.
+void
+checkmap(char *p)
+{
+  int i;
+
+  for(i = 0; i < SZ; i++)
+    if(p[i] != (char)(i % 251))
+      fail("mapped contents");
+  for(; i < PGROUNDUP(SZ); i++)
+    if(p[i] != 0)
+      fail("zeroes past the end");
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *p, c;
+  int fd, fds[4], i, pid, xstatus;
+  struct stat st;
+
+  makefile();
+
+  // private: stores don't reach the file.
+  if((fd = open(file, O_RDONLY)) < 0)
+    fail("open");
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap private");
+  close(fd);
+  checkmap(p);
+  for(i = 0; i < NPAGE; i++)
+    p[i*PGSIZE] = i + 'A';
+  if(munmap(p, SZ) < 0)
+    fail("munmap private");
+  checkfile(0);
+
+  // a read-only file can't be mapped shared and writable.
+  if((fd = open(file, O_RDONLY)) < 0)
+    fail("open");
+  if(mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1)
+    fail("mmap permission check");
+  close(fd);
+
+  // shared: stores reach the file at munmap(), here unmapping
+  // the first page on its own, then the rest.
+  if((fd = open(file, O_RDWR)) < 0)
+    fail("open");
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap shared");
+  close(fd);
+  checkmap(p);
+  for(i = 0; i < NPAGE; i++)
+    p[i*PGSIZE] = i + 'A';
+  if(munmap(p, PGSIZE) < 0 || munmap(p + PGSIZE, SZ - PGSIZE) < 0)
+    fail("munmap shared");
+  checkfile(1);
+
+  // a shared mapping stays shared across fork(), and exit()
+  // writes back the child's stores.
+  makefile();
+  if((fd = open(file, O_RDWR)) < 0)
+    fail("open");
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap shared");
+  close(fd);
+  checkmap(p);
+  pid = fork();
+  if(pid < 0)
+    fail("fork");
+  if(pid == 0){
+    for(i = 0; i < NPAGE; i++)
+      p[i*PGSIZE] = i + 'A';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  if(p[0] != 'A')
+    fail("shared across fork");
+  checkfile(1);
+  if(munmap(p, SZ) < 0)
+    fail("munmap");
+
+  // processes sharing a mapping see each other's stores at
+  // once, whichever of them touches a page first; and read()
+  // sees them too, before they are written back.
+  makefile();
+  if((fd = open(file, O_RDWR)) < 0)
+    fail("open");
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap shared");
+  if(pipe(fds) < 0 || pipe(fds+2) < 0)
+    fail("pipe");
+  pid = fork();
+  if(pid < 0)
+    fail("fork");
+  if(pid == 0){
+    for(i = 0; i < NPAGE; i++)
+      p[i*PGSIZE] = i + 'A';
+    write(fds[1], "x", 1);
+    read(fds[2], &c, 1);
+    exit(0);
+  }
+  if(read(fds[0], &c, 1) != 1)
+    fail("pipe read");
+  for(i = 0; i < NPAGE; i++)
+    if(p[i*PGSIZE] != i + 'A')
+      fail("child's first touch");
+  checkfile(1);
+  write(fds[3], "x", 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  for(i = 0; i < 4; i++)
+    close(fds[i]);
+
+  // and the mapping sees write().
+  if(write(fd, "z", 1) != 1)
+    fail("write");
+  if(p[0] != 'z')
+    fail("write() seen by the mapping");
+  close(fd);
+  if(munmap(p, SZ) < 0)
+    fail("munmap");
+
+  // stores to a file truncated since mmap() don't bring it back.
+  makefile();
+  if((fd = open(file, O_RDWR)) < 0)
+    fail("open");
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap shared");
+  close(fd);
+  for(i = 0; i < NPAGE; i++)
+    p[i*PGSIZE] = i + 'A';
+  if((fd = open(file, O_RDWR|O_TRUNC)) < 0)
+    fail("truncate");
+  close(fd);
+  if(munmap(p, SZ) < 0)
+    fail("munmap");
+  if(stat(file, &st) < 0 || st.size != 0)
+    fail("write-back after truncation");
+
+  unlink(file);
+  printf("mmaptest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,97 @@
+//
+// time resolving a deep path name, one that exists and one
+// that doesn't, and check that lookups see names come and go.
+//
+// usage: pathbench [lookups]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define DEPTH 8
+
+char deep[] = "pb.d/d1/d2/d3/d4/d5/d6/d7/file";
+char missing[] = "pb.d/d1/d2/d3/d4/d5/d6/d7/nofile";
+
+void
+fail(char *what)
+{
+  fprintf(2, "pathbench: %s failed\n", what);
+  exit(1);
+}
+
+// create or remove the DEPTH directories leading to deep.
+void
+tree(int make)
+{
+  char path[sizeof(deep)];
+  char *p;
+  int i, n;
+
+  for(i = 0; i < DEPTH; i++){
+    // cut path after its first n components: creating
+    // from the top down, removing from the bottom up.
+    strcpy(path, deep);
+    n = make ? i : DEPTH - 1 - i;
+    for(p = path; *p; p++){
+      if(*p == '/' && n-- == 0){
+        *p = 0;
+        break;
+      }
+    }
+    if(make && mkdir(path) < 0)
+      fail("mkdir");
+    if(!make && unlink(path) < 0)
+      fail("unlink");
+  }
+}
+
+int
+bench(char *path, int n, int want)
+{
+  struct stat st;
+  int i, start = uptime();
+
+  for(i = 0; i < n; i++)
+    if((stat(path, &st) == 0) != want)
+      fail("stat");
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 2000, fd;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: pathbench [lookups]\n");
+    exit(1);
+  }
+
+  tree(1);
+  if((fd = open(deep, O_CREATE|O_RDWR)) < 0)
+    fail("create");
+  close(fd);
+
+  printf("%d lookups of %s: %d ticks\n", n, deep, bench(deep, n, 1));
+  printf("%d lookups of %s: %d ticks\n", n, missing, bench(missing, n, 0));
+
+  // the cached names must follow unlink() and create.
+  if(unlink(deep) < 0)
+    fail("unlink");
+  bench(deep, 1, 0);
+  if((fd = open(missing, O_CREATE|O_RDWR)) < 0)
+    fail("create");
+  close(fd);
+  bench(missing, 1, 1);
+  if(unlink(missing) < 0)
+    fail("unlink");
+
+  tree(0);
+  printf("pathbench: OK\n");
+  exit(0);
+}
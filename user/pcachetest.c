@@ -0,0 +1,92 @@
+//
+// check that reads through the page cache see every write,
+// and time a cold read of a file against a cached one.
+//
+// usage: pcachetest [kilobytes]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+char *file = "pcachetest.tmp";
+char buf[4096];
+
+void
+fail(char *what)
+{
+  fprintf(2, "pcachetest: %s failed\n", what);
+  unlink(file);
+  exit(1);
+}
+
+// write kb kilobytes, with byte i holding (i + seed) % 253.
+void
+fill(int kb, int seed, int omode)
+{
+  int fd, i, j;
+
+  if((fd = open(file, omode)) < 0)
+    fail("open");
+  for(i = 0; i < kb; i += sizeof(buf) / 1024){
+    for(j = 0; j < sizeof(buf); j++)
+      buf[j] = (i * 1024 + j + seed) % 253;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+      fail("write");
+  }
+  close(fd);
+}
+
+// read the file back, checking it against fill(kb, seed),
+// and return the ticks it took.
+int
+check(int kb, int seed)
+{
+  int fd, i, j, n, start = uptime();
+
+  if((fd = open(file, O_RDONLY)) < 0)
+    fail("open");
+  for(i = 0; i < kb; i += sizeof(buf) / 1024){
+    if((n = read(fd, buf, sizeof(buf))) != sizeof(buf))
+      fail("read");
+    for(j = 0; j < sizeof(buf); j++)
+      if(buf[j] != (char)((i * 1024 + j + seed) % 253))
+        fail("contents");
+  }
+  if(read(fd, buf, 1) != 0)
+    fail("end of file");
+  close(fd);
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb = 1024, t0, t1;
+
+  if(argc > 1)
+    kb = atoi(argv[1]);
+  if(kb < 4){
+    fprintf(2, "usage: pcachetest [kilobytes]\n");
+    exit(1);
+  }
+  kb -= kb % 4;
+
+  fill(kb, 0, O_CREATE|O_RDWR|O_TRUNC);
+  t0 = check(kb, 0);
+  t1 = check(kb, 0);
+  printf("first read: %d KB in %d ticks\n", kb, t0);
+  printf("second read: %d KB in %d ticks\n", kb, t1);
+
+  // overwrite the cached file in place, then truncate and
+  // refill it: neither may leave stale pages behind.
+  fill(kb, 7, O_RDWR);
+  check(kb, 7);
+  fill(kb / 2, 11, O_RDWR|O_TRUNC);
+  check(kb / 2, 11);
+
+  unlink(file);
+  printf("pcachetest: OK\n");
+  exit(0);
+}
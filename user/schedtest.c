@@ -0,0 +1,105 @@
+//
+// scheduler benchmark: time pipe ping-pong between two
+// processes, alone and while CPU-bound processes compete for
+// the harts. An interactive-friendly scheduler keeps the
+// ping-pong time close to the unloaded one, and the CPU-bound
+// processes should still all finish.
+//
+// usage: schedtest [nhog]
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NROUND  2000        // ping-pong round trips
+#define SPIN    200000000   // loop iterations per CPU-bound process
+
+// bounce a byte NROUND times between two processes.
+// returns elapsed ticks.
+int
+pingpong(void)
+{
+  int p1[2], p2[2], i, pid, t0;
+  char c = 0;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf("schedtest: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("schedtest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < NROUND; i++){
+      if(read(p1[0], &c, 1) != 1 || write(p2[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < NROUND; i++){
+    if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1){
+      printf("schedtest: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  wait(0);
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+  return uptime() - t0;
+}
+
+// burn CPU, then exit.
+void
+hog(void)
+{
+  volatile int i;
+
+  for(i = 0; i < SPIN; i++)
+    ;
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nhog = NCPU, i, pid, xstatus, t0, t;
+
+  if(argc > 1)
+    nhog = atoi(argv[1]);
+  if(nhog < 0 || nhog > NPROC/2){
+    fprintf(2, "usage: schedtest [nhog]\n");
+    exit(1);
+  }
+
+  printf("schedtest: ping-pong alone: %d ticks\n", pingpong());
+
+  t0 = uptime();
+  for(i = 0; i < nhog; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("schedtest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      hog();
+  }
+  printf("schedtest: ping-pong with %d CPU-bound: %d ticks\n", nhog, pingpong());
+  for(i = 0; i < nhog; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("schedtest: hog failed\n");
+      exit(1);
+    }
+  }
+  t = uptime() - t0;
+  printf("schedtest: %d CPU-bound finished in %d ticks\n", nhog, t);
+  printf("schedtest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,72 @@
+//
+// check that many concurrent sleep()s each last about as long
+// as asked, and that kill() cuts one short.
+//
+// usage: sleeptest [sleepers]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int n = 20, i, pid, start, t, xstatus, bad = 0;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: sleeptest [sleepers]\n");
+    exit(1);
+  }
+
+  // sleeper i sleeps 1+i%70 ticks, so some wait for
+  // more than one turn of a timer wheel.
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "sleeptest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      start = uptime();
+      sleep(1 + i % 70);
+      t = uptime() - start;
+      // a hart's ticks and uptime()'s differ by a tick at most;
+      // allow a few more for getting a CPU after waking.
+      if(t < i % 70 || t > 1 + i % 70 + 10){
+        fprintf(2, "sleeptest: sleep(%d) took %d ticks\n", 1 + i % 70, t);
+        exit(1);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      bad = 1;
+  }
+  if(bad)
+    exit(1);
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "sleeptest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(1000000);
+    exit(0);
+  }
+  start = uptime();
+  sleep(2);
+  kill(pid);
+  wait(0);
+  if(uptime() - start > 100){
+    fprintf(2, "sleeptest: kill did not wake a sleeper\n");
+    exit(1);
+  }
+  printf("sleeptest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,106 @@
+//
+// compare moving data through a pipe with write()/read()
+// against vmsplice(), which remaps whole pages.
+//
+// usage: splicetest [megabytes]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define BUFSZ (16*PGSIZE)
+
+// a page-aligned buffer of n bytes.
+char*
+pagebuf(int n)
+{
+  char *p = sbrk(n + PGSIZE);
+
+  if(p == (char*)-1){
+    fprintf(2, "splicetest: sbrk failed\n");
+    exit(1);
+  }
+  return (char*)PGROUNDUP((uint64)p);
+}
+
+// send mb megabytes through a pipe from a child to this process,
+// with vmsplice() if splice is set, and check what arrives.
+// returns the ticks it took.
+int
+run(int mb, int splice)
+{
+  int fds[2], pid, i, j, n, m, start, xstatus;
+  int total = mb * 1024 * 1024;
+  char *buf;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "splicetest: pipe failed\n");
+    exit(1);
+  }
+  start = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "splicetest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    buf = pagebuf(BUFSZ);
+    for(i = 0; i < total; i += BUFSZ){
+      // a child with its pages still shared by the pipe must
+      // get copies, so that the reader sees the old contents.
+      for(j = 0; j < BUFSZ; j += PGSIZE)
+        buf[j] = (i + j) / PGSIZE;
+      n = splice ? vmsplice(fds[1], buf, BUFSZ) : write(fds[1], buf, BUFSZ);
+      if(n != BUFSZ){
+        fprintf(2, "splicetest: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  close(fds[1]);
+  buf = pagebuf(BUFSZ);
+  for(i = 0; i < total; i += n){
+    n = 0;
+    while(n < BUFSZ){
+      m = splice ? vmsplice(fds[0], buf + n, BUFSZ - n) : read(fds[0], buf + n, BUFSZ - n);
+      if(m <= 0){
+        fprintf(2, "splicetest: read failed\n");
+        exit(1);
+      }
+      n += m;
+    }
+    for(j = 0; j < BUFSZ; j += PGSIZE){
+      if(buf[j] != (char)((i + j) / PGSIZE)){
+        fprintf(2, "splicetest: wrong data at %d\n", i + j);
+        exit(1);
+      }
+    }
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 8;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb < 1){
+    fprintf(2, "usage: splicetest [megabytes]\n");
+    exit(1);
+  }
+
+  printf("write/read: %d MB in %d ticks\n", mb, run(mb, 0));
+  printf("vmsplice: %d MB in %d ticks\n", mb, run(mb, 1));
+  exit(0);
+}
@@ -1,6 +1,10 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/uring.h"
+#include "kernel/vdso.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
 char*
@@ -134,3 +138,70 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Like uptime(), but read from the vdso page, with no system call.
+int
+vuptime(void)
+{
+  return ((volatile struct vdso*)VDSO)->ticks;
+}
+
+// Like getpid(), but read from the vdso page, with no system call.
+int
+vgetpid(void)
+{
+  return ((struct vdsoproc*)VDSOPROC)->pid;
+}
+
+static struct uring *ring;
+
+// Queue a request on the process's uring, setting the ring up
+// if need be. The request is carried out by the next uringsubmit()
+// or uringwait(), and its completion carries data.
+// Returns 0, or -1 if the ring is full or can't be set up.
+int
+uringprep(int op, int fd, void *addr, int n, uint64 data)
+{
+  struct uringsqe *sqe;
+
+  if(ring == 0 && (ring = (struct uring*)uringsetup()) == (struct uring*)-1){
+    ring = 0;
+    return -1;
+  }
+  if(ring->sqtail - ring->sqhead >= URING_NSQE)
+    return -1;
+  sqe = &ring->sq[ring->sqtail % URING_NSQE];
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->addr = (uint64)addr;
+  sqe->n = n;
+  sqe->data = data;
+  ring->sqtail++;
+  return 0;
+}
+
+// Carry out the queued requests, as far as there is room
+// for their completions, in one system call.
+// Returns how many were carried out.
+int
+uringsubmit(void)
+{
+  if(ring == 0)
+    return 0;
+  return uringenter();
+}
+
+// Take the oldest completion, submitting the queued requests
+// first if there is none yet.
+// Returns 0, or -1 if nothing is queued or in the ring.
+int
+uringwait(struct uringcqe *cqe)
+{
+  if(ring == 0)
+    return -1;
+  if(ring->cqhead == ring->cqtail && uringsubmit() <= 0)
+    return -1;
+  *cqe = ring->cq[ring->cqhead % URING_NCQE];
+  ring->cqhead++;
+  return 0;
+}
@@ -0,0 +1,120 @@
+//
+// compare small writes and reads done one system call at a
+// time against the same requests batched through the uring.
+//
+// usage: uringtest [requests]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/uring.h"
+#include "user/user.h"
+
+#define SZ 16
+
+char *file = "uringtest.tmp";
+
+void
+fail(char *what)
+{
+  fprintf(2, "uringtest: %s failed\n", what);
+  unlink(file);
+  exit(1);
+}
+
+// write n records of SZ bytes with write(), then read them back.
+int
+plain(int n)
+{
+  char buf[SZ];
+  int fd, i, start = uptime();
+
+  if((fd = open(file, O_CREATE|O_RDWR|O_TRUNC)) < 0)
+    fail("open");
+  for(i = 0; i < n; i++){
+    memset(buf, i, SZ);
+    if(write(fd, buf, SZ) != SZ)
+      fail("write");
+  }
+  close(fd);
+  if((fd = open(file, O_RDONLY)) < 0)
+    fail("open");
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, SZ) != SZ || buf[0] != (char)i)
+      fail("read");
+  }
+  close(fd);
+  return uptime() - start;
+}
+
+// queue op for records [i, i+k) on fd, then reap them.
+void
+batch(int op, int fd, char *bufs, int i, int k)
+{
+  struct uringcqe cqe;
+  int j;
+
+  for(j = 0; j < k; j++){
+    if(op == UR_WRITE)
+      memset(bufs + j*SZ, i + j, SZ);
+    if(uringprep(op, fd, bufs + j*SZ, SZ, i + j) < 0)
+      fail("uringprep");
+  }
+  for(j = 0; j < k; j++){
+    if(uringwait(&cqe) < 0 || cqe.res != SZ || cqe.data != i + j)
+      fail(op == UR_WRITE ? "ring write" : "ring read");
+    if(op == UR_READ && bufs[j*SZ] != (char)(i + j))
+      fail("ring read data");
+  }
+}
+
+// open the file with omode, do op on n records, and close
+// it, all through the ring.
+void
+ringpass(int op, int omode, int n)
+{
+  static char bufs[URING_NSQE*SZ];
+  struct uringcqe cqe;
+  int fd, i, k;
+
+  if(uringprep(UR_OPEN, -1, file, omode, 0) < 0 ||
+     uringwait(&cqe) < 0 || (fd = cqe.res) < 0)
+    fail("ring open");
+  for(i = 0; i < n; i += k){
+    k = n - i < URING_NSQE ? n - i : URING_NSQE;
+    batch(op, fd, bufs, i, k);
+  }
+  if(uringprep(UR_CLOSE, fd, 0, 0, 0) < 0 || uringwait(&cqe) < 0 || cqe.res != 0)
+    fail("ring close");
+}
+
+// the same as plain(), through the ring.
+int
+ring(int n)
+{
+  int start = uptime();
+
+  ringpass(UR_WRITE, O_CREATE|O_RDWR|O_TRUNC, n);
+  ringpass(UR_READ, O_RDONLY, n);
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 4096;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: uringtest [requests]\n");
+    exit(1);
+  }
+
+  printf("system calls: %d records in %d ticks\n", n, plain(n));
+  printf("uring: %d records in %d ticks\n", n, ring(n));
+  unlink(file);
+  printf("uringtest: OK\n");
+  exit(0);
+}
@@ -1,5 +1,6 @@
 struct stat;
 struct rtcdate;
+struct uringcqe;
 
 // system calls
 int fork(void);
@@ -23,6 +24,12 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int idletime(uint64*, int);
+int vmsplice(int, void*, int);
+void* uringsetup(void);
+int uringenter(void);
+void* mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +47,8 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int vuptime(void);
+int vgetpid(void);
+int uringprep(int, int, void*, int, uint64);
+int uringsubmit(void);
+int uringwait(struct uringcqe*);
@@ -2350,6 +2350,69 @@ sbrkarg(char *s)
   } 
 }
 
+// sbrk() allocates lazily: a huge heap costs nothing until
+// touched, untouched pages read as zero, and system calls
+// can read and write untouched pages.
+void
+sbrklazy(char *s)
+{
+  enum { HUGE=1024*1024*1024 };
+  char *a, *b;
+  int fds[2], i, pid, xstatus;
+
+  a = sbrk(HUGE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk huge failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < HUGE; i += 64*1024*1024){
+    if(a[i] != 0){
+      printf("%s: untouched page not zero\n", s);
+      exit(1);
+    }
+    a[i] = 1;
+  }
+
+  // copyin() from and copyout() to untouched pages.
+  b = a + HUGE - 2*PGSIZE;
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], b, 10) != 10){
+    printf("%s: write from untouched page failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], b + PGSIZE, 10) != 10 || b[PGSIZE] != 0){
+    printf("%s: read into untouched page failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < HUGE; i += 64*1024*1024)
+      if(a[i] != 1)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong heap\n", s);
+    exit(1);
+  }
+
+  if(sbrk(-HUGE) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
 void
 validatetest(char *s)
 {
@@ -2858,6 +2921,7 @@ main(int argc, char *argv[])
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
+    {sbrklazy, "sbrklazy"},
     {sbrklast, "sbrklast"},
     {sbrk8000, "sbrk8000"},
     {validatetest, "validatetest"},
@@ -36,3 +36,9 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("idletime");
+entry("vmsplice");
+entry("uringsetup");
+entry("uringenter");
+entry("mmap");
+entry("munmap");
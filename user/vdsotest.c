@@ -0,0 +1,103 @@
+//
+// check vuptime() and vgetpid() against the system calls,
+// check that system calls can't write the read-only pages,
+// and compare their cost.
+//
+// usage: vdsotest [calls]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "user/user.h"
+
+void
+check(void)
+{
+  int t0, t, t1;
+
+  if(vgetpid() != getpid()){
+    fprintf(2, "vdsotest: vgetpid %d, getpid %d\n", vgetpid(), getpid());
+    exit(1);
+  }
+  t0 = uptime();
+  t = vuptime();
+  t1 = uptime();
+  if(t < t0 || t > t1){
+    fprintf(2, "vdsotest: vuptime %d not in [%d, %d]\n", t, t0, t1);
+    exit(1);
+  }
+}
+
+// the kernel must refuse to read() into either page;
+// a write to VDSO would change ticks for every process.
+void
+readonly(void)
+{
+  char buf[8];
+  int fds[2];
+
+  if(pipe(fds) < 0){
+    fprintf(2, "vdsotest: pipe failed\n");
+    exit(1);
+  }
+  memset(buf, 0x7f, sizeof(buf));
+  if(write(fds[1], buf, sizeof(buf)) != sizeof(buf) ||
+     write(fds[1], buf, sizeof(buf)) != sizeof(buf)){
+    fprintf(2, "vdsotest: write failed\n");
+    exit(1);
+  }
+  if(read(fds[0], (char*)VDSO, sizeof(buf)) > 0 ||
+     read(fds[0], (char*)VDSOPROC, sizeof(buf)) > 0){
+    fprintf(2, "vdsotest: read into a vdso page succeeded\n");
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  check();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100000, i, pid, xstatus, start;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1){
+    fprintf(2, "usage: vdsotest [calls]\n");
+    exit(1);
+  }
+
+  check();
+  readonly();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "vdsotest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // the child has its own pid page.
+    check();
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    getpid();
+    uptime();
+  }
+  printf("getpid+uptime: %d calls in %d ticks\n", n, uptime() - start);
+  start = uptime();
+  for(i = 0; i < n; i++){
+    vgetpid();
+    vuptime();
+  }
+  printf("vgetpid+vuptime: %d calls in %d ticks\n", n, uptime() - start);
+  printf("vdsotest: OK\n");
+  exit(0);
+}